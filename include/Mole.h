@@ -10,13 +10,23 @@
 #ifndef MOLE_MOLE_H
 #define MOLE_MOLE_H
 
+#include <atomic>
 #include <condition_variable>
+#include <cstring>
+#include <ctime>
 #include <deque>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <shared_mutex>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #include "fmt/format.h"
+#include "fmt/compile.h"
 #include "concurrent/blockingconcurrentqueue.h"
 
 namespace hzd {
@@ -36,105 +46,852 @@ using ssize_t = long int;
 #else
 #define MOLE_API __declspec(dllimport)
 #endif // MOLE_EXPORTS
-#define FILENAME(x) (strrchr(x,'\\') ? strrchr(x,'\\')+1 : x)
+#define MOLE_PATH_SEPARATORS "/\\"
 #else  // NOT WIN32 || _WIN32 end
 #define MOLE_API
-#define FILENAME(x) (strrchr(x, '/') ? strrchr(x, '/')+1 : x)
+#define MOLE_PATH_SEPARATORS "/"
 #endif // WIN32 || _WIN32
 
+// basename of a string literal such as __FILE__, found at compile time
+#define FILENAME(x) ((x) + std::integral_constant<size_t, hzd::detail::BaseOffset(x)>::value)
+// str if it is a string literal, which the backend may keep a pointer to,
+// nullptr otherwise. The type alone cannot tell "..." from a const char
+// array on the caller's stack, only GCC and Clang can, elsewhere every
+// format counts as a runtime one and is formatted eagerly.
+#if defined(__GNUC__) || defined(__clang__)
+#define MOLE_LITERAL(str) (__builtin_constant_p(str) ? hzd::detail::Literal(str) : nullptr)
+#else
+#define MOLE_LITERAL(str) nullptr
+#endif
+
 #define MB (1024*1024)  // M Bytes
 #define CACHE_BUF_SIZE (16 * MB)
 #define META_BULK_SIZE 16
+#define META_RING_SIZE 4096 // slots per producer thread, power of two
+#define CACHE_LINE_SIZE 64
+#define MAX_LATENCY_US 1000 // longest an idle backend sleeps before polling again
+#define FLUSH_INTERVAL_MS 1000 // longest a line waits in the file buffer
+#define META_INLINE_SIZE 112 // payload bytes a record holds inline, a ring slot then spans three cache lines
+#define META_SPILL_KEEP (64 * 1024) // largest spill buffer a ring slot holds on to between records
+#define DROP_REPORT_MS 1000 // shortest time between two "messages dropped" records
+#define CONSOLE_BATCH_SIZE (64 * 1024) // console bytes gathered before a write while the backend stays busy
+#define LINE_LAYOUT "%Y-%m-%d %H:%M:%S.%f [%L] %v [%s:%# thread:%t]" // the default line, see Pattern
+
+// FMT_COMPILE parses formats at build time from C++17 on, before that fmt
+// would parse them again on every call, so the MOLE_*_C macros fall back to
+// the plain ones there
+#if defined(__cpp_if_constexpr) && defined(__cpp_return_type_deduction)
+#define MOLE_COMPILED_FORMAT 1
+#else
+#define MOLE_COMPILED_FORMAT 0
+#endif
+
+// DeferFormat lets the backend format arguments of type T. They are copied
+// bitwise into the record, so only opt in trivially copyable types whose
+// text depends on their own bytes alone, nothing they point or refer to:
+//   template<> struct hzd::DeferFormat<Point> : std::true_type {};
+// Other types are formatted on the calling thread.
+template<class T>
+struct DeferFormat : std::false_type {};
+
+namespace detail {
+
+template<size_t... I>
+struct index_sequence {};
+template<size_t N, size_t... I>
+struct make_index_sequence : make_index_sequence<N - 1, N - 1, I...> {};
+template<size_t... I>
+struct make_index_sequence<0, I...> { using type = index_sequence<I...>; };
+
+constexpr bool IsSeparator(char c, const char *separators = MOLE_PATH_SEPARATORS) {
+  return *separators != '\0' && (c == *separators || IsSeparator(c, separators + 1));
+}
+constexpr size_t LastOf(size_t right, size_t left) { return right != 0 ? right : left; }
+// one past the last separator in path[begin, end), 0 if there is none. The
+// range is halved on every call so long paths stay far below the
+// compiler's constexpr depth limit.
+constexpr size_t LastSeparator(const char *path, size_t begin, size_t end) {
+  return end - begin == 0 ? 0
+      : end - begin == 1 ? (IsSeparator(path[begin]) ? begin + 1 : 0)
+      : LastOf(LastSeparator(path, begin + (end - begin) / 2, end),
+               LastSeparator(path, begin, begin + (end - begin) / 2));
+}
+template<size_t N>
+constexpr size_t BaseOffset(const char (&path)[N]) { return LastSeparator(path, 0, N - 1); }
+
+// Kind names the encoding of an argument with one letter so that packed
+// arguments can be decoded without the program that wrote them, e.g. by
+// mole-decode. Signed integers are a h i l by size, unsigned ones A H I L,
+// 's' is a string, 'z' a C string that keeps its address, and '?' marks
+// types only the program itself knows how to format.
+template<class T>
+struct Kind {
+  static constexpr char value =
+      std::is_same<T, bool>::value ? 'b' :
+      std::is_same<T, char>::value ? 'c' :
+      std::is_same<T, float>::value ? 'f' :
+      std::is_same<T, double>::value ? 'd' :
+      std::is_same<T, void *>::value || std::is_same<T, const void *>::value ? 'p' :
+      std::is_same<T, wchar_t>::value || std::is_same<T, char16_t>::value
+          || std::is_same<T, char32_t>::value || !std::is_integral<T>::value ? '?' :
+      std::is_signed<T>::value
+          ? (sizeof(T) == 1 ? 'a' : sizeof(T) == 2 ? 'h' : sizeof(T) == 4 ? 'i' : sizeof(T) == 8 ? 'l' : '?')
+          : (sizeof(T) == 1 ? 'A' : sizeof(T) == 2 ? 'H' : sizeof(T) == 4 ? 'I' : sizeof(T) == 8 ? 'L' : '?');
+};
+
+// Codec packs a log argument into Meta::content on the producer and unpacks it
+// on the backend. Numbers, void pointers and DeferFormat types are copied
+// bitwise, strings by content since the caller's buffer may be gone by the
+// time it is formatted. Anything else, such as a struct holding a pointer or
+// fmt::join over iterators, could dangle by then and is formatted eagerly.
+template<class T, class Enable = void>
+struct Codec {
+  static constexpr bool deferrable = false;
+};
+
+template<class T>
+struct Codec<T, typename std::enable_if<std::is_arithmetic<T>::value || std::is_same<T, void *>::value
+                                            || std::is_same<T, const void *>::value
+                                            || DeferFormat<T>::value>::type> {
+  static_assert(std::is_trivially_copyable<T>::value, "DeferFormat types are copied bitwise");
+  static constexpr bool deferrable = true;
+  static constexpr char kind = Kind<T>::value;
+  using type = T;
+  static size_t Size(const T &) { return sizeof(T); }
+  static void Encode(char *&cursor, const T &value) {
+    memcpy(cursor, &value, sizeof(T));
+    cursor += sizeof(T);
+  }
+  static T Decode(const char *&cursor) {
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    memcpy(&storage, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return *reinterpret_cast<T *>(&storage);
+  }
+};
+
+struct StringCodec {
+  static constexpr bool deferrable = true;
+  static constexpr char kind = 's';
+  using type = fmt::string_view;
+  static size_t Size(fmt::string_view value) { return sizeof(size_t) + value.size(); }
+  static void Encode(char *&cursor, fmt::string_view value) {
+    size_t size = value.size();
+    memcpy(cursor, &size, sizeof(size));
+    memcpy(cursor + sizeof(size), value.data(), size);
+    cursor += sizeof(size) + size;
+  }
+  static fmt::string_view Decode(const char *&cursor) {
+    size_t size;
+    memcpy(&size, cursor, sizeof(size));
+    fmt::string_view value{cursor + sizeof(size), size};
+    cursor += sizeof(size) + size;
+    return value;
+  }
+};
+
+// a C string as the backend sees it, formatted as its text or, with {:p},
+// as the address the caller passed
+struct CString {
+  const void *address;
+  fmt::string_view text;
+};
+
+struct CStringCodec {
+  static constexpr bool deferrable = true;
+  static constexpr char kind = 'z';
+  using type = CString;
+  static size_t Size(const char *value) {
+    return sizeof(const void *) + StringCodec::Size(value ? value : "");
+  }
+  static void Encode(char *&cursor, const char *value) {
+    memcpy(cursor, &value, sizeof(const void *));
+    cursor += sizeof(const void *);
+    StringCodec::Encode(cursor, value ? value : "");
+  }
+  static CString Decode(const char *&cursor) {
+    CString value;
+    memcpy(&value.address, cursor, sizeof(const void *));
+    cursor += sizeof(const void *);
+    value.text = StringCodec::Decode(cursor);
+    return value;
+  }
+};
+
+template<> struct Codec<char *> : CStringCodec {};
+template<> struct Codec<const char *> : CStringCodec {};
+template<> struct Codec<std::string> : StringCodec {};
+template<> struct Codec<fmt::string_view> : StringCodec {};
+#ifdef __cpp_lib_string_view
+template<> struct Codec<std::string_view> : StringCodec {};
+#endif
+
+// the format of a log statement when it is a const array, writable arrays and
+// runtime strings give nullptr. A const array may still live on the stack,
+// MOLE_LITERAL only passes real literals here.
+template<size_t N>
+constexpr const char *Literal(const char (&format)[N]) { return format; }
+template<size_t N>
+constexpr const char *Literal(char (&)[N]) { return nullptr; }
+template<class S>
+constexpr const char *Literal(const S &) { return nullptr; }
+
+// S is a format FMT_COMPILE turned into formatting code
+template<class S>
+struct Compiled : std::integral_constant<bool, MOLE_COMPILED_FORMAT && fmt::detail::is_compiled_string<S>::value> {};
+
+template<class... Args>
+struct Deferrable : std::true_type {};
+template<class T, class... Args>
+struct Deferrable<T, Args...>
+    : std::integral_constant<bool, Codec<T>::deferrable && Deferrable<Args...>::value> {};
+
+template<class... Args>
+struct Deferred {
+  template<class... Ts>
+  static size_t Size(const Ts &... args) {
+    size_t size = 0;
+    int expand[] = {0, (size += Codec<Args>::Size(args), 0)...};
+    (void) expand;
+    return size;
+  }
+  template<class... Ts>
+  static void Encode(char *cursor, const Ts &... args) {
+    int expand[] = {0, (Codec<Args>::Encode(cursor, args), 0)...};
+    (void) expand;
+    (void) cursor;
+  }
+  static void Render(fmt::memory_buffer &out, const char *format, const char *data) {
+    render(out, format, data, typename make_index_sequence<sizeof...(Args)>::type{});
+  }
+  // the same for a compiled format S, which carries its own format string
+  template<class S>
+  static void RenderCompiled(fmt::memory_buffer &out, const char *, const char *data) {
+    renderCompiled<S>(out, data, typename make_index_sequence<sizeof...(Args)>::type{});
+  }
+  // Render or RenderCompiled<S>, whichever fits S
+  template<class S>
+  static decltype(&Render) Renderer(std::false_type) { return &Render; }
+  template<class S>
+  static decltype(&Render) Renderer(std::true_type) { return &RenderCompiled<S>; }
+  // the Kind of every argument in order
+  static const char *Signature() {
+    static constexpr char signature[] = {Codec<Args>::kind..., '\0'};
+    return signature;
+  }
+
+ private:
+  template<size_t... I>
+  static void render(fmt::memory_buffer &out, const char *format, const char *data, index_sequence<I...>) {
+    // braced initialization guarantees left-to-right decoding
+    std::tuple<typename Codec<Args>::type...> values{Codec<Args>::Decode(data)...};
+    (void) data;
+    fmt::vformat_to(fmt::appender(out), format, fmt::make_format_args(std::get<I>(values)...));
+  }
+  template<class S, size_t... I>
+  static void renderCompiled(fmt::memory_buffer &out, const char *data, index_sequence<I...>) {
+    std::tuple<typename Codec<Args>::type...> values{Codec<Args>::Decode(data)...};
+    (void) data;
+    fmt::format_to(fmt::appender(out), S{}, std::get<I>(values)...);
+  }
+};
+
+} // detail
+} // hzd
+
+namespace fmt {
+// takes the specs fmt takes for a const char *, which differ from a string's
+template<>
+struct formatter<hzd::detail::CString> {
+  FMT_CONSTEXPR auto parse(format_parse_context &ctx) -> decltype(ctx.begin()) {
+    // the presentation type comes last, right before the closing brace
+    auto end = ctx.begin();
+    for (int depth = 0; end != ctx.end() && (*end != '}' || depth-- != 0); ++end) {
+      if (*end == '{') ++depth;
+    }
+    address_ = end != ctx.begin() && end[-1] == 'p';
+    return address_ ? pointer_.parse(ctx) : text_.parse(ctx);
+  }
+  template<class Context>
+  auto format(const hzd::detail::CString &value, Context &ctx) const -> decltype(ctx.out()) {
+    return address_ ? pointer_.format(value.address, ctx) : text_.format(value.text, ctx);
+  }
+
+ private:
+  bool address_{false};
+  formatter<const void *> pointer_;
+  formatter<string_view> text_;
+};
+} // fmt
+
+namespace hzd {
+
+class FileWriter;
+class Compressor;
+class TscClock;
+class Pattern;
+class Sink;
+class ConsoleSink;
+class FileSink;
+class BinarySink;
 
 class MOLE_API Mole {
  public:
-  template<class T>
-  using Chan = moodycamel::BlockingConcurrentQueue<T>;
-
   enum class Level : uint32_t {
     kTRACE = 0, kINFO, kDEBUG, kWARN, kERROR, kFATAL, kSILENCE,
   };
   enum Operation {
-    kNONE, kENABLE, kDISABLE, kCONSOLE, kNCONSOLE, kSAVE, kNSAVE, kFILTER
+    kNONE, kCONSOLE, kNCONSOLE, kSAVE, kNSAVE, kNAME
   };
+  // where producers take timestamps from, from most precise to cheapest
+  // kSYSTEM reads system_clock, kCOARSE the kernel's tick granular
+  // CLOCK_REALTIME_COARSE and kTSC the CPU time stamp counter, which the
+  // backend converts to wall time
+  enum class Clock : uint32_t { kSYSTEM, kCOARSE, kTSC };
+  // what Log does when the calling thread's ring is full: wait for the
+  // backend, drop the new record or overwrite the oldest one. The oldest
+  // record cannot be overwritten while the backend is writing it, nor when
+  // it is an operation, kOVERWRITE drops the new record then, so neither
+  // kDROP nor kOVERWRITE ever waits for a slow sink. Operations such as
+  // Save() are never dropped, they wait.
+  enum class Overflow : uint32_t { kBLOCK, kDROP, kOVERWRITE };
   using time_point = std::chrono::system_clock::time_point;
+  using Render = void (*)(fmt::memory_buffer &out, const char *format, const char *data);
+  // Site describes one logging statement. MOLE_LOG defines it as a static
+  // next to the statement, so it is set up once and records only carry a
+  // pointer to it, which also identifies the statement to the backend.
+  struct Site {
+    Level level;
+    uint32_t line;
+    const char *file;
+    const char *function;
+    // the format string if it is a literal, required for deferred formatting
+    const char *format;
+  };
+  // the thread records come from, captured once when it first logs
+  struct Thread {
+    // OS thread id, the one top -H, perf and debuggers show
+    uint64_t id{0};
+    // backend only, set through ThreadName()
+    std::string name{};
+    // "id" or "id(name)", what text lines print after "thread:"
+    std::string label{};
+  };
+  // Payload is a record's text or packed arguments. Up to META_INLINE_SIZE
+  // bytes live in the record itself, longer payloads spill to a heap buffer
+  // which the ring slot keeps for the records after it. Releasing the slot
+  // is what hands the buffer back to the producer, so the producer thread
+  // both allocates and frees it and the backend only ever reads it.
+  class Payload {
+   public:
+    Payload() = default;
+    Payload(const Payload &) = delete;
+    Payload &operator=(const Payload &) = delete;
+    Payload(Payload &&other) noexcept { *this = std::move(other); }
+    Payload &operator=(Payload &&other) noexcept {
+      if (this == &other) return *this;
+      spill_ = std::move(other.spill_);
+      size_ = other.size_;
+      capacity_ = other.capacity_;
+      if (!spill_) memcpy(inline_, other.inline_, size_);
+      other.size_ = 0;
+      other.capacity_ = META_INLINE_SIZE;
+      return *this;
+    }
+
+    char *Data() { return spill_ ? spill_.get() : inline_; }
+    const char *Data() const { return spill_ ? spill_.get() : inline_; }
+    size_t Size() const { return size_; }
+    size_t Capacity() const { return capacity_; }
+    // starts the next record, before anything is written into the payload.
+    // A spill buffer over META_SPILL_KEEP is released here, a one off huge
+    // record should not pin its buffer in the slot.
+    void Clear() {
+      if (capacity_ > META_SPILL_KEEP) {
+        spill_.reset();
+        capacity_ = META_INLINE_SIZE;
+      }
+      size_ = 0;
+    }
+    // the bytes are left as they are unless the payload has to grow, which
+    // discards them
+    void Resize(size_t size) {
+      if (size > capacity_) {
+        capacity_ = static_cast<uint32_t>(size > 2 * capacity_ ? size : 2 * capacity_);
+        spill_.reset(new char[capacity_]);
+      }
+      size_ = static_cast<uint32_t>(size);
+    }
+    void Assign(fmt::string_view value) {
+      Clear();
+      Resize(value.size());
+      if (value.size() != 0) memcpy(Data(), value.data(), value.size());
+    }
+    fmt::string_view View() const { return {Data(), size_}; }
+
+   private:
+    std::unique_ptr<char[]> spill_{};
+    uint32_t size_{0};
+    uint32_t capacity_{META_INLINE_SIZE};
+    char inline_[META_INLINE_SIZE];
+  };
   struct Meta {
-    Level level{Level::kSILENCE};
+    const Site *site{nullptr};
     Operation op{kNONE};
-    std::string content{};
-    std::thread::id thread_id{};
-    uint32_t line{0};
-    const char *file{nullptr};
+    // time holds raw TSC ticks until the backend converts it
+    bool ticks{false};
+    // formatted text, or the packed arguments when render is set
+    Payload content{};
+    Render render{nullptr};
+    // Kind letters of the packed arguments, set together with render
+    const char *signature{nullptr};
+    Thread *thread{nullptr};
     time_point time{};
 
-    explicit Meta(Level level = Level::kSILENCE,
-                  Operation op = kNONE,
-                  std::string content = "",
-                  std::thread::id thread_id = {},
-                  uint32_t line = 0,
-                  const char *file = nullptr,
-                  time_point time = {});
+    explicit Meta(const Site *site = nullptr, Operation op = kNONE, fmt::string_view content = {});
   };
 
   Mole();
   ~Mole();
   void Log(Meta &&meta);
+  // format is checked against args where Log is called, at compile time
+  // from C++20 on, as fmt::format does
+  template<class... Args>
+  void Log(const Site &site, fmt::format_string<Args...> format, Args &&... args) {
+    log(site, fmt::runtime(format.get()), std::forward<Args>(args)...);
+  }
+  // the same for a format FMT_COMPILE turned into formatting code
+  template<class S, class... Args,
+      typename std::enable_if<fmt::detail::is_compiled_string<S>::value, int>::type = 0>
+  void Log(const Site &site, const S &format, Args &&... args) {
+    log(site, format, std::forward<Args>(args)...);
+  }
   void Enable(bool is_enable);
   void Console(bool is_console);
   void Save(bool is_save, std::string path = "Mole.log");
   void LogFilter(Level level);
+  // names the calling thread in its records from now on
+  void ThreadName(std::string name);
+  // sets up the calling thread's ring up front, and a spill buffer in each
+  // slot when content_capacity exceeds META_INLINE_SIZE. Once a thread is
+  // prepared logging records that fit never calls the allocator, as long as
+  // content_capacity stays within META_SPILL_KEEP.
+  void Prepare(size_t content_capacity = META_INLINE_SIZE);
+  void Latency(std::chrono::microseconds max_latency);
+  // switches the timestamp source, a source the machine lacks falls back to
+  // the next more expensive one, returns the source now in use
+  Clock Timestamp(Clock clock);
+  void OnFull(Overflow policy);
+  // records of the level lost to a full ring so far
+  uint64_t Dropped(Level level) const;
+  // blocks until every record logged before the call is written out
+  void Flush();
+  void FlushOn(Level level);
+  void FlushEvery(std::chrono::milliseconds interval);
+  // rolls the Save() file once it reaches max_size bytes, 0 never rolls
+  void Rotate(size_t max_size, size_t max_files = 5);
+  // starts a new Save() file every period, strftime fields in the path
+  // name each one after the period it covers
+  void Rollover(std::chrono::seconds period);
+  // gzips Save() files in the background once they are rotated away
+  void Compress(bool is_compress);
+  // sets the line layout of the console, the Save() file and every sink
+  // without one of its own, see Pattern for the fields, "" restores LINE_LAYOUT
+  void Layout(std::string pattern);
+  // sinks added here receive records next to the console and Save() outputs
+  void AddSink(std::shared_ptr<Sink> sink);
+  // returns once the backend no longer calls the sink, which may then be
+  // closed. Called from a sink, the backend lets go of it on its next pass.
+  void RemoveSink(const std::shared_ptr<Sink> &sink);
+  // static so that the log macros reach the threshold without a call
+  static bool Enabled(Level level) {
+    return static_cast<uint32_t>(level) >= threshold_.load(std::memory_order_relaxed);
+  }
+  static const char *LevelName(Level level);
   static Mole &Instance();
 
  private:
-  bool enable_ = true, console_ = true, save_ = false, stop_ = false;
-  Level filter{Level::kTRACE};
-  std::thread thread_{loop, this};
-  Chan<Meta> meta_chan_;
+  // lowest level that passes the filter, kDISABLED is or'ed in while disabled.
+  // There is only the one Mole, Instance().
+  static constexpr uint32_t kDISABLED = 1u << 31;
+  static std::atomic<uint32_t> threshold_;
+  std::atomic<bool> stop_{false};
+
+  // every thread that logs owns a ring, the backend polls all of them
+  struct Producer;
+  std::mutex producers_mutex_;
+  std::vector<std::shared_ptr<Producer>> producers_;
+  std::atomic<bool> producers_dirty_{false};
+
+  // an idle backend parks on semaphore_, the next producer to commit wakes it
+  std::atomic<bool> parked_{false};
+  std::atomic<int64_t> max_latency_us_{MAX_LATENCY_US};
+  moodycamel::LightweightSemaphore semaphore_{0, 0};
+
+  // tsc_ is calibrated once before kTSC is first published, the backend
+  // recalibrates it from then on
+  std::atomic<uint32_t> clock_{static_cast<uint32_t>(Clock::kSYSTEM)};
+  std::mutex clock_mutex_;
+  std::unique_ptr<TscClock> tsc_;
 
-  std::string save_path_;
-  FILE *fp{};
-  char buffer[CACHE_BUF_SIZE]{};
-  size_t cursor{};
+  std::atomic<uint32_t> overflow_{static_cast<uint32_t>(Overflow::kBLOCK)};
+  static constexpr size_t kLEVELS = static_cast<size_t>(Level::kSILENCE) + 1;
+  std::atomic<uint64_t> dropped_[kLEVELS]{};
+  std::atomic<uint64_t> dropped_total_{0};
+  // backend only, drops already reported and when the next report may go out
+  uint64_t reported_[kLEVELS]{};
+  uint64_t reported_total_{0};
+  std::chrono::steady_clock::time_point report_deadline_{};
+
+  // records at or above flush_level_ push the file buffer to disk at once
+  std::atomic<uint32_t> flush_level_{static_cast<uint32_t>(Level::kSILENCE)};
+  std::atomic<int64_t> flush_interval_ms_{FLUSH_INTERVAL_MS};
+  struct Barrier;
+  std::mutex barriers_mutex_;
+  std::vector<Barrier *> barriers_;
+  std::atomic<bool> barriers_pending_{false};
+
+  std::mutex sinks_mutex_;
+  std::vector<std::shared_ptr<Sink>> sinks_;
+  std::atomic<bool> sinks_dirty_{false};
+  // guarded by sinks_mutex_, RemoveSink waits on sinks_cond_ until the
+  // backend has taken up the list it left behind
+  std::condition_variable sinks_cond_;
+  uint64_t sinks_version_{0}, sinks_applied_{0};
+  // guarded by sinks_mutex_, compiled into pattern_ on the next refresh
+  std::string layout_{LINE_LAYOUT};
+  bool layout_dirty_{false};
+
+  // backend only, the built-in outputs toggled by Console() and Save()
+  bool console_ = true, save_ = false;
+  std::shared_ptr<ConsoleSink> console_sink_;
+  std::shared_ptr<FileSink> file_sink_;
+  std::vector<std::shared_ptr<Sink>> active_sinks_;
+  // backend only, set while some sink holds output not yet flushed
+  bool unflushed_{false};
+  // backend only, set once sinks got records since the last EndBatch
+  bool batched_{false};
+  std::chrono::steady_clock::time_point flush_deadline_{};
+
+  // backend only, the layout of sinks without their own
+  std::unique_ptr<Pattern> pattern_;
+  // backend only, reused for every record
+  fmt::memory_buffer text_buf_, line_buf_, console_buf_, sink_buf_;
+
+  std::thread thread_{loop, this};
 
   static void loop(Mole *mole);
   void writeMeta(Meta &&meta);
+  void housekeep();
+  void reportDrops();
+  // producer side, reserve hands out the next slot with time and thread
+  // filled in, or nullptr if the record is dropped, commit publishes it
+  Meta *reserve(uint8_t tag);
+  void commit(uint8_t tag);
+  void drop(uint8_t level);
+  void refreshSinks();
+  void endBatch();
+  void wake();
+  Producer &producer();
+
+  template<class S, class... Args>
+  void log(const Site &site, const S &format, Args &&... args);
+  template<class S, class... Args>
+  static void pack(Meta &meta, std::true_type, const S &format, Args &&... args);
+  template<class S, class... Args>
+  static void pack(Meta &meta, std::false_type, const S &format, Args &&... args);
 
 };
 
+// Pattern is a line layout compiled once into a flat list of steps, which
+// append straight into a buffer for every record. Fields:
+//   %Y %m %d %H %M %S  local date and time, %e milliseconds, %f microseconds
+//   %l level name, %L level centered in seven columns, colored on kCOLORED sinks
+//   %v message, %s file, %# line, %! function, %t thread
+//   %% a percent sign, anything else is copied as is
+// Every line ends with a newline. Runs of date and time fields are rendered
+// once a second, so the default layout costs no more than a fixed one.
+class MOLE_API Pattern {
+ public:
+  explicit Pattern(const std::string &pattern = LINE_LAYOUT);
+  // appends the line to plain and the same line with colored level fields to
+  // colored, either may be nullptr
+  void Format(const Mole::Meta &meta, fmt::string_view message,
+              fmt::memory_buffer *plain, fmt::memory_buffer *colored);
+  const std::string &Source() const { return source_; }
+
+ private:
+  enum class Field : uint8_t {
+    kTEXT, kCLOCK, kYEAR, kMONTH, kDAY, kHOUR, kMINUTE, kSECOND, kMILLI, kMICRO,
+    kLEVEL, kTAG, kMESSAGE, kFILE, kLINE, kFUNCTION, kTHREAD,
+  };
+  // kTEXT copies text_[begin, begin + size), kCLOCK appends clocks_[begin]
+  struct Step {
+    Field field;
+    uint32_t begin;
+    uint32_t size;
+  };
+  // a run of steps that only changes once a second and its latest rendering
+  struct Clock {
+    std::vector<Step> steps;
+    std::string text;
+  };
+
+  std::string source_, text_;
+  std::vector<Step> steps_;
+  std::vector<Clock> clocks_;
+  int64_t second_{INT64_MIN};
+
+  void renderClocks(int64_t second);
+};
+
+// Sink is where rendered records end up. Write, Flush and Sync are only ever
+// called from the backend thread, so implementations need no locking.
+class MOLE_API Sink {
+ public:
+  // the line a sink is handed, kRAW sinks get an empty one and encode the
+  // Meta themselves, which spares the backend the text rendering
+  enum class Style { kPLAIN, kCOLORED, kRAW };
+
+  explicit Sink(Mole::Level level = Mole::Level::kTRACE, Style style = Style::kPLAIN);
+  virtual ~Sink() = default;
+  virtual void Write(const Mole::Meta &meta, fmt::string_view line) = 0;
+  // Flush pushes buffered output on, Sync also waits until it has landed
+  virtual void Flush() {}
+  virtual void Sync() { Flush(); }
+  // called once the backend has caught up with the producers, sinks that
+  // gather records to write them in one go hand them on here
+  virtual void EndBatch() {}
+  void SetLevel(Mole::Level level) {
+    level_.store(static_cast<uint32_t>(level), std::memory_order_relaxed);
+  }
+  bool Accepts(Mole::Level level) const {
+    return static_cast<uint32_t>(level) >= level_.load(std::memory_order_relaxed);
+  }
+  Style LineStyle() const { return style_; }
+  // gives the sink a line layout of its own, see Pattern, "" goes back to
+  // the one set through Mole::Layout. kRAW sinks have no lines to lay out.
+  void SetLayout(std::string pattern);
+
+ private:
+  friend class Mole;
+  std::atomic<uint32_t> level_;
+  const Style style_;
+  std::mutex layout_mutex_;
+  std::string layout_;
+  std::atomic<bool> layout_dirty_{false};
+  // backend only, compiled from layout_, nullptr for the Mole wide layout
+  std::unique_ptr<Pattern> pattern_;
+
+  void compileLayout();
+};
+
+class MOLE_API ConsoleSink : public Sink {
+ public:
+  explicit ConsoleSink(Mole::Level level = Mole::Level::kTRACE, bool colored = true);
+  ~ConsoleSink() override;
+  void Write(const Mole::Meta &meta, fmt::string_view line) override;
+  void Flush() override;
+  // writes the gathered lines to stdout with a single write(2)
+  void EndBatch() override;
+
+ private:
+  fmt::memory_buffer batch_;
+};
+
+class MOLE_API FileSink : public Sink {
+ public:
+  explicit FileSink(Mole::Level level = Mole::Level::kTRACE);
+  explicit FileSink(const std::string &path, Mole::Level level = Mole::Level::kTRACE);
+  ~FileSink() override;
+  // path may hold strftime fields such as "app-%Y%m%d-%H.log"
+  bool Open(const std::string &path);
+  void Close();
+  bool IsOpen() const;
+  const std::string &Path() const { return path_; }
+  const std::string &FilePath() const { return file_path_; }
+  // once the file reaches max_size bytes it is renamed to <name>.1<ext>,
+  // older ones shift up to <name>.<max_files><ext>, 0 disables rotation
+  void SetRotation(size_t max_size, size_t max_files = 5);
+  // switches to a new file at every period boundary counted from local
+  // midnight, e.g. hours(1) or hours(24), 0 disables it
+  void SetRollover(std::chrono::seconds period);
+  // rotated files are gzipped on a low priority thread, <name>.1<ext>.gz
+  void SetCompression(bool is_compress);
+  void Write(const Mole::Meta &meta, fmt::string_view line) override;
+  void Flush() override;
+  void Sync() override;
+
+ private:
+  std::string path_, file_path_;
+  // declared first so it outlives writer_, whose I/O thread posts to it
+  std::unique_ptr<Compressor> compressor_;
+  std::atomic<bool> compress_{false};
+  std::unique_ptr<FileWriter> writer_;
+  std::atomic<size_t> max_size_{0}, max_files_{5};
+  std::atomic<int64_t> period_{0};
+  std::atomic<bool> reschedule_{false};
+  // backend only, bytes in the current file and when it has to be replaced
+  size_t written_{0};
+  size_t rotations_{0};
+  Mole::time_point rollover_at_{Mole::time_point::max()};
+
+  static std::string expandPath(const std::string &pattern, time_t time);
+  Mole::time_point nextRollover(time_t time) const;
+  void rollover(time_t time);
+  void rotate();
+};
+
+// BinarySink writes records as compact frames instead of text: a callsite
+// id, the time as a delta to the previous record, the thread and the packed
+// arguments as they came from the producer. Each Site's level, location,
+// format and signature go into a dictionary entry in front of its first
+// record. mole-decode turns the file back into the text Mole writes, given
+// the same layout through -l.
+class MOLE_API BinarySink : public Sink {
+ public:
+  explicit BinarySink(Mole::Level level = Mole::Level::kTRACE);
+  explicit BinarySink(const std::string &path, Mole::Level level = Mole::Level::kTRACE);
+  ~BinarySink() override;
+  bool Open(const std::string &path);
+  void Close();
+  bool IsOpen() const;
+  void Write(const Mole::Meta &meta, fmt::string_view line) override;
+  void Flush() override;
+  void Sync() override;
+
+ private:
+  std::unique_ptr<FileWriter> writer_;
+  // backend only, ids handed out so far and the time of the last record
+  std::unordered_map<const Mole::Site *, uint64_t> sites_;
+  // the label last written for each thread, a rename gets a new id
+  std::unordered_map<const Mole::Thread *, std::pair<uint64_t, std::string>> threads_;
+  uint64_t thread_ids_{0};
+  int64_t last_us_{0};
+  fmt::memory_buffer frame_, text_;
+
+  void writeHeader();
+};
+
+template<class S, class... Args>
+void Mole::log(const Site &site, const S &format, Args &&... args) {
+  if (!Enabled(site.level)) return;
+  uint8_t tag = static_cast<uint8_t>(site.level);
+  Meta *meta = reserve(tag);
+  if (!meta) return;
+  // the record is written in place so its slot's buffer gets reused
+  meta->site = &site;
+  meta->op = kNONE;
+  meta->render = nullptr;
+  meta->signature = nullptr;
+  meta->content.Clear();
+#ifdef MOLE_EAGER
+  pack(*meta, std::false_type{}, format, std::forward<Args>(args)...);
+#else
+  // only literal format strings are sure to outlive the trip to the backend
+  if (site.format) {
+    pack(*meta, detail::Deferrable<typename std::decay<Args>::type...>{}, format, std::forward<Args>(args)...);
+  } else {
+    pack(*meta, std::false_type{}, format, std::forward<Args>(args)...);
+  }
+#endif
+  commit(tag);
+}
+
+template<class S, class... Args>
+void Mole::pack(Meta &meta, std::true_type, const S &, Args &&... args) {
+  using Deferred = detail::Deferred<typename std::decay<Args>::type...>;
+  meta.content.Resize(Deferred::Size(args...));
+  Deferred::Encode(meta.content.Data(), args...);
+  meta.render = Deferred::template Renderer<S>(detail::Compiled<S>{});
+  meta.signature = Deferred::Signature();
+}
+
+template<class S, class... Args>
+void Mole::pack(Meta &meta, std::false_type, const S &format, Args &&... args) {
+  // formats straight into the payload, a text too long for it is formatted
+  // again once the payload has grown to fit. fmt only reads the arguments,
+  // forwarding them twice keeps views such as fmt::join rvalues both times.
+  size_t size = fmt::format_to_n(meta.content.Data(), meta.content.Capacity(), format,
+                                 std::forward<Args>(args)...).size;
+  if (size > meta.content.Capacity()) {
+    meta.content.Resize(size);
+    fmt::format_to_n(meta.content.Data(), size, format, std::forward<Args>(args)...);
+  }
+  meta.content.Resize(size);
+}
+
 #if defined(WIN32) || defined(_WIN32)
 #pragma warning(pop)
 #endif
 
 #ifdef MOLE_IGNORE
+#define MOLE_LOG(level,str,...)
 #define MOLE_TRACE(str,...)
 #define MOLE_DEBUG(str,...)
 #define MOLE_INFO(str,...)
 #define MOLE_WARN(str,...)
 #define MOLE_ERROR(str,...)
 #define MOLE_FATAL(str,...)
+#define MOLE_LOG_C(level,str,...)
+#define MOLE_TRACE_C(str,...)
+#define MOLE_DEBUG_C(str,...)
+#define MOLE_INFO_C(str,...)
+#define MOLE_WARN_C(str,...)
+#define MOLE_ERROR_C(str,...)
+#define MOLE_FATAL_C(str,...)
 #define MOLE_LEVEL(level)
 #define MOLE_ENABLE(is_enable)
 #define MOLE_SAVE(is_save,...)
 #define MOLE_CONSOLE(is_console)
+#define MOLE_LATENCY(max_latency)
+#define MOLE_FLUSH()
+#define MOLE_FLUSH_ON(level)
+#define MOLE_FLUSH_EVERY(interval)
+#define MOLE_ROTATE(max_size,...)
+#define MOLE_ROLLOVER(period)
+#define MOLE_COMPRESS(is_compress)
+#define MOLE_THREAD_NAME(name)
+#define MOLE_TIMESTAMP(clock)
+#define MOLE_ON_FULL(policy)
+#define MOLE_PREPARE(...)
+#define MOLE_LAYOUT(pattern)
 #else
-#define MOLE_TRACE(str, ...) do { \
-  hzd::Mole::Instance().Log(hzd::Mole::Meta{hzd::Mole::Level::kTRACE,hzd::Mole::Operation::kNONE,fmt::format(str,##__VA_ARGS__), {},__LINE__,FILENAME(__FILE__),{}}); \
-}while(0)
-#define MOLE_DEBUG(str, ...) do { \
-  hzd::Mole::Instance().Log(hzd::Mole::Meta{hzd::Mole::Level::kDEBUG,hzd::Mole::Operation::kNONE,fmt::format(str,##__VA_ARGS__), {},__LINE__,FILENAME(__FILE__),{}}); \
-}while(0)
-#define MOLE_INFO(str, ...) do { \
-  hzd::Mole::Instance().Log(hzd::Mole::Meta{hzd::Mole::Level::kINFO,hzd::Mole::Operation::kNONE,fmt::format(str,##__VA_ARGS__), {},__LINE__,FILENAME(__FILE__),{}}); \
-}while(0)
-#define MOLE_WARN(str, ...) do { \
-  hzd::Mole::Instance().Log(hzd::Mole::Meta{hzd::Mole::Level::kWARN,hzd::Mole::Operation::kNONE,fmt::format(str,##__VA_ARGS__), {},__LINE__,FILENAME(__FILE__),{}}); \
-}while(0)
-#define MOLE_ERROR(str, ...) do { \
-  hzd::Mole::Instance().Log(hzd::Mole::Meta{hzd::Mole::Level::kERROR,hzd::Mole::Operation::kNONE,fmt::format(str,##__VA_ARGS__), {},__LINE__,FILENAME(__FILE__),{}}); \
+// level has to be the same every time the statement runs, it is part of the
+// site. A filtered statement costs one relaxed load and a compare.
+#define MOLE_LOG(level, str, ...) do { \
+  if (hzd::Mole::Enabled(level)) { \
+    static const hzd::Mole::Site mole_site_{ \
+        level, __LINE__, FILENAME(__FILE__), __func__, MOLE_LITERAL(str)}; \
+    hzd::Mole::Instance().Log(mole_site_,str,##__VA_ARGS__); \
+  } \
 }while(0)
-#define MOLE_FATAL(str, ...) do { \
-  hzd::Mole::Instance().Log(hzd::Mole::Meta{hzd::Mole::Level::kFATAL,hzd::Mole::Operation::kNONE,fmt::format(str,##__VA_ARGS__), {},__LINE__,FILENAME(__FILE__),{}}); \
+#define MOLE_TRACE(str, ...) MOLE_LOG(hzd::Mole::Level::kTRACE,str,##__VA_ARGS__)
+#define MOLE_DEBUG(str, ...) MOLE_LOG(hzd::Mole::Level::kDEBUG,str,##__VA_ARGS__)
+#define MOLE_INFO(str, ...) MOLE_LOG(hzd::Mole::Level::kINFO,str,##__VA_ARGS__)
+#define MOLE_WARN(str, ...) MOLE_LOG(hzd::Mole::Level::kWARN,str,##__VA_ARGS__)
+#define MOLE_ERROR(str, ...) MOLE_LOG(hzd::Mole::Level::kERROR,str,##__VA_ARGS__)
+#define MOLE_FATAL(str, ...) MOLE_LOG(hzd::Mole::Level::kFATAL,str,##__VA_ARGS__)
+// the same for a literal str that FMT_COMPILE parses at build time, a
+// malformed format then fails to compile. FMT_COMPILE only takes strings
+// with static storage, so str is safe to keep without MOLE_LITERAL.
+#if MOLE_COMPILED_FORMAT
+#define MOLE_LOG_C(level, str, ...) do { \
+  if (hzd::Mole::Enabled(level)) { \
+    static const hzd::Mole::Site mole_site_{ \
+        level, __LINE__, FILENAME(__FILE__), __func__, hzd::detail::Literal(str)}; \
+    hzd::Mole::Instance().Log(mole_site_,FMT_COMPILE(str),##__VA_ARGS__); \
+  } \
 }while(0)
+#else
+#define MOLE_LOG_C(level, str, ...) MOLE_LOG(level,str,##__VA_ARGS__)
+#endif
+#define MOLE_TRACE_C(str, ...) MOLE_LOG_C(hzd::Mole::Level::kTRACE,str,##__VA_ARGS__)
+#define MOLE_DEBUG_C(str, ...) MOLE_LOG_C(hzd::Mole::Level::kDEBUG,str,##__VA_ARGS__)
+#define MOLE_INFO_C(str, ...) MOLE_LOG_C(hzd::Mole::Level::kINFO,str,##__VA_ARGS__)
+#define MOLE_WARN_C(str, ...) MOLE_LOG_C(hzd::Mole::Level::kWARN,str,##__VA_ARGS__)
+#define MOLE_ERROR_C(str, ...) MOLE_LOG_C(hzd::Mole::Level::kERROR,str,##__VA_ARGS__)
+#define MOLE_FATAL_C(str, ...) MOLE_LOG_C(hzd::Mole::Level::kFATAL,str,##__VA_ARGS__)
 #define MOLE_LEVEL(level) do { \
   hzd::Mole::Instance().LogFilter(level);\
 }while(0)
@@ -147,6 +904,42 @@ class MOLE_API Mole {
 #define MOLE_CONSOLE(is_console) do { \
   hzd::Mole::Instance().Console(is_console);                                      \
 }while(0)
+#define MOLE_LATENCY(max_latency) do { \
+  hzd::Mole::Instance().Latency(max_latency);\
+}while(0)
+#define MOLE_FLUSH() do { \
+  hzd::Mole::Instance().Flush();\
+}while(0)
+#define MOLE_FLUSH_ON(level) do { \
+  hzd::Mole::Instance().FlushOn(level);\
+}while(0)
+#define MOLE_FLUSH_EVERY(interval) do { \
+  hzd::Mole::Instance().FlushEvery(interval);\
+}while(0)
+#define MOLE_ROTATE(max_size, ...) do { \
+  hzd::Mole::Instance().Rotate(max_size,##__VA_ARGS__);\
+}while(0)
+#define MOLE_ROLLOVER(period) do { \
+  hzd::Mole::Instance().Rollover(period);\
+}while(0)
+#define MOLE_COMPRESS(is_compress) do { \
+  hzd::Mole::Instance().Compress(is_compress);\
+}while(0)
+#define MOLE_THREAD_NAME(name) do { \
+  hzd::Mole::Instance().ThreadName(name);\
+}while(0)
+#define MOLE_TIMESTAMP(clock) do { \
+  hzd::Mole::Instance().Timestamp(clock);\
+}while(0)
+#define MOLE_ON_FULL(policy) do { \
+  hzd::Mole::Instance().OnFull(policy);\
+}while(0)
+#define MOLE_PREPARE(...) do { \
+  hzd::Mole::Instance().Prepare(__VA_ARGS__);\
+}while(0)
+#define MOLE_LAYOUT(pattern) do { \
+  hzd::Mole::Instance().Layout(pattern);\
+}while(0)
 #endif
 
 } // hzd
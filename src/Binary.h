@@ -0,0 +1,72 @@
+/**
+  ******************************************************************************
+  * @file           : Binary.h
+  * @author         : agent
+  * @brief          : Frame layout shared by BinarySink and mole-decode
+  * @date           : 2026/10/17
+  ******************************************************************************
+  */
+
+#ifndef MOLE_BINARY_H
+#define MOLE_BINARY_H
+
+#include <cstdint>
+#include <cstring>
+
+#include "fmt/format.h"
+
+namespace hzd {
+namespace binary {
+
+// A binary log is a sequence of frames, each starting with its tag. Numbers
+// are LEB128 varints, strings a varint length followed by the bytes.
+//
+//   header  'M' 'O' 'L' 'E' version little_endian sizeof(size_t) sizeof(void*)
+//   site    'S' id level line file function format signature
+//   thread  'T' id name
+//   record  'R' site_id time_delta thread_id payload_size payload
+//
+// time_delta is the zigzag encoded distance in microseconds to the previous
+// record, the first one counts from the epoch. The payload holds the packed
+// arguments exactly as detail::Codec wrote them, so it is only readable on a
+// machine with the same byte order and sizes, which the header records. A
+// header may show up again where another run appended to the file, it starts
+// over with fresh ids and time.
+static constexpr char kMAGIC[4] = {'M', 'O', 'L', 'E'};
+// version 2 added C strings, 'z' in signatures
+static constexpr uint8_t kVERSION = 2;
+static constexpr char kSITE = 'S';
+static constexpr char kTHREAD = 'T';
+static constexpr char kRECORD = 'R';
+
+inline bool LittleEndian() {
+  uint16_t probe = 1;
+  uint8_t first;
+  memcpy(&first, &probe, 1);
+  return first == 1;
+}
+
+inline void PutVarint(fmt::memory_buffer &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+inline void PutString(fmt::memory_buffer &out, fmt::string_view value) {
+  PutVarint(out, value.size());
+  out.append(value.data(), value.data() + value.size());
+}
+
+inline uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+} // binary
+} // hzd
+#endif //MOLE_BINARY_H
@@ -0,0 +1,231 @@
+/**
+  ******************************************************************************
+  * @file           : Gzip.cpp
+  * @author         : agent
+  * @brief          : Minimal gzip writer used to compress rotated log files
+  * @date           : 2026/10/17
+  ******************************************************************************
+  */
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "Gzip.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace hzd {
+
+static constexpr size_t kBLOCK_SIZE = 1 << 20; // input bytes per deflate block
+static constexpr size_t kWINDOW_SIZE = 1 << 15;
+static constexpr size_t kHASH_SIZE = 1 << 15;
+static constexpr size_t kMIN_MATCH = 3;
+static constexpr size_t kMAX_MATCH = 258;
+static constexpr size_t kMAX_CHAIN = 32;       // candidates tried per position
+
+static const uint16_t kLENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t kLENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t kDISTANCE_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t kDISTANCE_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+struct CrcTable {
+  uint32_t value[256];
+  CrcTable() {
+    for (uint32_t index = 0; index < 256; ++index) {
+      uint32_t crc = index;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = crc & 1 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+      }
+      value[index] = crc;
+    }
+  }
+};
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size) {
+  static const CrcTable table;
+  crc = ~crc;
+  for (size_t index = 0; index < size; ++index) {
+    crc = table.value[(crc ^ data[index]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+// deflate streams are packed least significant bit first
+class BitWriter {
+ public:
+  explicit BitWriter(FILE *fp) : fp_(fp) {}
+
+  void Put(uint32_t bits, unsigned count) {
+    bits_ |= static_cast<uint64_t>(bits) << count_;
+    count_ += count;
+    while (count_ >= 8) {
+      out_.push_back(static_cast<uint8_t>(bits_));
+      bits_ >>= 8;
+      count_ -= 8;
+    }
+    if (out_.size() >= (1 << 16)) Drain();
+  }
+
+  // Huffman codes are defined most significant bit first
+  void PutCode(uint32_t code, unsigned length) {
+    uint32_t reversed = 0;
+    for (unsigned bit = 0; bit < length; ++bit) {
+      reversed = (reversed << 1) | ((code >> bit) & 1);
+    }
+    Put(reversed, length);
+  }
+
+  void Align() {
+    if (count_ != 0) Put(0, 8 - count_);
+  }
+
+  void Drain() {
+    if (!out_.empty()) fwrite(out_.data(), 1, out_.size(), fp_);
+    out_.clear();
+  }
+
+ private:
+  FILE *fp_;
+  std::vector<uint8_t> out_;
+  uint64_t bits_{0};
+  unsigned count_{0};
+};
+
+static void putSymbol(BitWriter &writer, unsigned symbol) {
+  if (symbol < 144) {
+    writer.PutCode(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    writer.PutCode(0x190 + symbol - 144, 9);
+  } else if (symbol < 280) {
+    writer.PutCode(symbol - 256, 7);
+  } else {
+    writer.PutCode(0xC0 + symbol - 280, 8);
+  }
+}
+
+static void putMatch(BitWriter &writer, size_t length, size_t distance) {
+  unsigned code = 28;
+  while (kLENGTH_BASE[code] > length) --code;
+  putSymbol(writer, 257 + code);
+  writer.Put(static_cast<uint32_t>(length - kLENGTH_BASE[code]), kLENGTH_EXTRA[code]);
+  code = 29;
+  while (kDISTANCE_BASE[code] > distance) --code;
+  writer.PutCode(code, 5);
+  writer.Put(static_cast<uint32_t>(distance - kDISTANCE_BASE[code]), kDISTANCE_EXTRA[code]);
+}
+
+static uint32_t hash3(const uint8_t *data) {
+  return ((data[0] << 10) ^ (data[1] << 5) ^ data[2]) & (kHASH_SIZE - 1);
+}
+
+// one fixed Huffman block, matches never reach into the previous block
+static void deflateBlock(BitWriter &writer, const uint8_t *data, size_t size, bool last,
+                         std::vector<int32_t> &head, std::vector<int32_t> &prev) {
+  writer.Put(last ? 1 : 0, 1);
+  writer.Put(1, 2);
+  std::fill(head.begin(), head.end(), -1);
+  auto insert = [&head, &prev, data](size_t pos) {
+    uint32_t hash = hash3(data + pos);
+    prev[pos & (kWINDOW_SIZE - 1)] = head[hash];
+    head[hash] = static_cast<int32_t>(pos);
+  };
+  size_t pos = 0;
+  while (pos < size) {
+    size_t best_length = 0, best_distance = 0;
+    if (pos + kMIN_MATCH <= size) {
+      size_t max_length = std::min(kMAX_MATCH, size - pos);
+      int32_t candidate = head[hash3(data + pos)];
+      for (size_t chain = 0; chain < kMAX_CHAIN && candidate >= 0; ++chain) {
+        size_t distance = pos - static_cast<size_t>(candidate);
+        if (distance > kWINDOW_SIZE) break;
+        const uint8_t *match = data + candidate;
+        if (match[best_length] == data[pos + best_length]) {
+          size_t length = 0;
+          while (length < max_length && match[length] == data[pos + length]) ++length;
+          if (length > best_length) {
+            best_length = length;
+            best_distance = distance;
+            if (length == max_length) break;
+          }
+        }
+        int32_t next = prev[static_cast<size_t>(candidate) & (kWINDOW_SIZE - 1)];
+        if (next >= candidate) break;
+        candidate = next;
+      }
+      insert(pos);
+    }
+    if (best_length >= kMIN_MATCH) {
+      putMatch(writer, best_length, best_distance);
+      for (size_t skipped = pos + 1; skipped < pos + best_length && skipped + kMIN_MATCH <= size; ++skipped) {
+        insert(skipped);
+      }
+      pos += best_length;
+    } else {
+      putSymbol(writer, data[pos]);
+      ++pos;
+    }
+  }
+  putSymbol(writer, 256);
+}
+
+static void putLE32(std::vector<uint8_t> &out, uint32_t value) {
+  for (int shift = 0; shift < 32; shift += 8) {
+    out.push_back(static_cast<uint8_t>(value >> shift));
+  }
+}
+
+bool GzipFile(const std::string &src, const std::string &dst) {
+  FILE *in = fopen(src.c_str(), "rb");
+  if (!in) return false;
+  FILE *out = fopen(dst.c_str(), "wb");
+  if (!out) {
+    fclose(in);
+    return false;
+  }
+
+  static const uint8_t kHEADER[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 3};
+  fwrite(kHEADER, 1, sizeof(kHEADER), out);
+
+  std::unique_ptr<uint8_t[]> block(new uint8_t[kBLOCK_SIZE]);
+  std::vector<int32_t> head(kHASH_SIZE), prev(kWINDOW_SIZE);
+  BitWriter writer(out);
+  uint32_t crc = 0, total = 0;
+  bool last = false;
+  while (!last) {
+    size_t size = fread(block.get(), 1, kBLOCK_SIZE, in);
+    int next = fgetc(in);
+    last = next == EOF;
+    if (!last) ungetc(next, in);
+    crc = crc32(crc, block.get(), size);
+    total += static_cast<uint32_t>(size);
+    deflateBlock(writer, block.get(), size, last, head, prev);
+  }
+  writer.Align();
+  writer.Drain();
+
+  std::vector<uint8_t> trailer;
+  putLE32(trailer, crc);
+  putLE32(trailer, total);
+  fwrite(trailer.data(), 1, trailer.size(), out);
+
+  bool ok = !ferror(in) && !ferror(out);
+  fclose(in);
+  ok = fclose(out) == 0 && ok;
+  if (!ok) remove(dst.c_str());
+  return ok;
+}
+
+} // hzd
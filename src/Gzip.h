@@ -0,0 +1,23 @@
+/**
+  ******************************************************************************
+  * @file           : Gzip.h
+  * @author         : agent
+  * @brief          : Minimal gzip writer used to compress rotated log files
+  * @date           : 2026/10/17
+  ******************************************************************************
+  */
+
+#ifndef MOLE_GZIP_H
+#define MOLE_GZIP_H
+
+#include <string>
+
+namespace hzd {
+
+// Compresses src into a gzip file at dst. Uses LZ77 with fixed Huffman codes,
+// which is far from zlib's best ratio but already shrinks log text several
+// fold at a fraction of the cost. Returns false if either file cannot be used.
+bool GzipFile(const std::string &src, const std::string &dst);
+
+} // hzd
+#endif //MOLE_GZIP_H
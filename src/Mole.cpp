@@ -10,66 +10,733 @@
 #ifdef _WIN32
 #define _CRT_SECURE_NO_WARNINGS
 #include <Windows.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define MOLE_HAS_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define MOLE_HAS_TSC
 #endif
 
 #include "Mole.h"
-#include "fmt/color.h"
+#include "Binary.h"
+#include "Gzip.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <ctime>
+#include <functional>
 #include <unordered_map>
-#include <regex>
 #include <utility>
-#include <iomanip>
 #include <iostream>
-#include <sstream>
 
 namespace hzd {
 
-static std::unordered_map<Mole::Level, std::string> level_map{
-    {Mole::Level::kSILENCE, "SILENCE"},
-    {Mole::Level::kTRACE, "TRACE"},
-    {Mole::Level::kDEBUG, "DEBUG"},
-    {Mole::Level::kINFO, "INFO"},
-    {Mole::Level::kWARN, "WARN"},
-    {Mole::Level::kERROR, "ERROR"},
-    {Mole::Level::kFATAL, "FATAL"},
+// a piece of text known at compile time
+struct Text {
+  const char *data;
+  size_t size;
 };
+#define MOLE_TEXT(literal) {literal, sizeof(literal) - 1}
+// the console escapes fmt::styled puts around text for fg(rgb) | bg(black)
+#define MOLE_COLOR(rgb) MOLE_TEXT("\x1b[38;2;" rgb "m\x1b[48;2;000;000;000m")
 
-static std::unordered_map<Mole::Level, fmt::color> color_schema{
-    {Mole::Level::kSILENCE, fmt::color::green_yellow},
-    {Mole::Level::kTRACE, fmt::color::cyan},
-    {Mole::Level::kDEBUG, fmt::color::magenta},
-    {Mole::Level::kINFO, fmt::color::green},
-    {Mole::Level::kWARN, fmt::color::yellow},
-    {Mole::Level::kERROR, fmt::color::red},
-    {Mole::Level::kFATAL, fmt::color::dark_red},
+// indexed by Level. Tags are the names centered in seven columns, ready to
+// copy into a line without a lookup or padding per record.
+static constexpr Text kLEVEL_NAMES[] = {
+    MOLE_TEXT("TRACE"), MOLE_TEXT("INFO"), MOLE_TEXT("DEBUG"), MOLE_TEXT("WARN"),
+    MOLE_TEXT("ERROR"), MOLE_TEXT("FATAL"), MOLE_TEXT("SILENCE"),
+};
+static constexpr Text kLEVEL_TAGS[] = {
+    MOLE_TEXT(" TRACE "), MOLE_TEXT(" INFO  "), MOLE_TEXT(" DEBUG "), MOLE_TEXT(" WARN  "),
+    MOLE_TEXT(" ERROR "), MOLE_TEXT(" FATAL "), MOLE_TEXT("SILENCE"),
 };
+static constexpr Text kLEVEL_COLORS[] = {
+    MOLE_COLOR("000;255;255"), // cyan
+    MOLE_COLOR("000;128;000"), // green
+    MOLE_COLOR("255;000;255"), // magenta
+    MOLE_COLOR("255;255;000"), // yellow
+    MOLE_COLOR("255;000;000"), // red
+    MOLE_COLOR("139;000;000"), // dark red
+    MOLE_COLOR("173;255;047"), // green yellow
+};
+static constexpr Text kCOLOR_RESET = MOLE_TEXT("\x1b[0m");
+#undef MOLE_COLOR
+#undef MOLE_TEXT
+static_assert(sizeof(kLEVEL_NAMES) / sizeof(kLEVEL_NAMES[0]) == static_cast<size_t>(Mole::Level::kSILENCE) + 1
+                  && sizeof(kLEVEL_TAGS) / sizeof(kLEVEL_TAGS[0]) == static_cast<size_t>(Mole::Level::kSILENCE) + 1
+                  && sizeof(kLEVEL_COLORS) / sizeof(kLEVEL_COLORS[0]) == static_cast<size_t>(Mole::Level::kSILENCE) + 1,
+              "one entry per level");
+
+// Ring is a bounded single-producer single-consumer queue. Every slot has a
+// sequence number telling whose turn it is: the producer may fill position p
+// once the slot reads p, the backend may take it once it reads p + 1. The
+// backend claims records by advancing head_ with a CAS, which lets a
+// producer with a full ring claim and overwrite the oldest record the same
+// way without ever touching a record the backend is reading.
+template<class T>
+class Ring {
+ public:
+  explicit Ring(size_t capacity) : mask_(capacity - 1), slots_(new Slot[capacity]) {
+    for (size_t index = 0; index < capacity; ++index) {
+      slots_[index].seq.store(index, std::memory_order_relaxed);
+    }
+  }
 
-Mole::Mole() {
-  stop_ = false;
+  // producer side, nullptr when the slot at the tail is still in use
+  T *Reserve() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    Slot &slot = slots_[tail & mask_];
+    if (slot.seq.load(std::memory_order_acquire) != tail) return nullptr;
+    return &slot.value;
+  }
+  // tag is the producer's note about the record, see OldestTag
+  void Commit(uint8_t tag) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    Slot &slot = slots_[tail & mask_];
+    slot.tag = tag;
+    slot.seq.store(tail + 1, std::memory_order_release);
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+  // true when the oldest record is waiting and not yet claimed by the backend
+  bool Full() const {
+    return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire) > mask_;
+  }
+  // only the producer writes tags, so reading the oldest one is race free
+  uint8_t OldestTag() const {
+    return slots_[tail_.load(std::memory_order_relaxed) & mask_].tag;
+  }
+  // claims the oldest record in place of the backend, nullptr if it was faster
+  T *Evict() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t oldest = tail - mask_ - 1;
+    if (!head_.compare_exchange_strong(oldest, oldest + 1, std::memory_order_acq_rel)) return nullptr;
+    return &slots_[tail & mask_].value;
+  }
+
+  // consumer side, claims up to max ready records starting at first
+  size_t Claim(size_t max, size_t &first) {
+    size_t head = head_.load(std::memory_order_acquire);
+    for (;;) {
+      size_t count = 0;
+      while (count < max && slots_[(head + count) & mask_].seq.load(std::memory_order_acquire) == head + count + 1) {
+        ++count;
+      }
+      if (count == 0) return 0;
+      if (head_.compare_exchange_weak(head, head + count, std::memory_order_acq_rel)) {
+        first = head;
+        return count;
+      }
+    }
+  }
+  // producer side, calls f on every slot, waiting for the backend to hand
+  // back those still holding records
+  template<class F>
+  void ForEach(F f) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    for (size_t position = tail; position != tail + mask_ + 1; ++position) {
+      Slot &slot = slots_[position & mask_];
+      while (slot.seq.load(std::memory_order_acquire) != position) {
+        std::this_thread::yield();
+      }
+      f(slot.value);
+    }
+  }
+
+  T &At(size_t position) { return slots_[position & mask_].value; }
+  void Release(size_t position) {
+    slots_[position & mask_].seq.store(position + mask_ + 1, std::memory_order_release);
+  }
+
+  // positions for flush barriers, monotonically increasing
+  size_t Head() const { return head_.load(std::memory_order_acquire); }
+  size_t Tail() const { return tail_.load(std::memory_order_acquire); }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> seq{0};
+    uint8_t tag{0};
+    T value{};
+  };
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  char pad0_[CACHE_LINE_SIZE]{};
+  std::atomic<size_t> head_{0};
+  char pad1_[CACHE_LINE_SIZE]{};
+  std::atomic<size_t> tail_{0};
+  char pad2_[CACHE_LINE_SIZE]{};
+};
+
+static FILE *openFile(const std::string &path) {
+  FILE *fp = fopen(path.c_str(), "ab");
+  // buffering is ours, a handed off buffer should reach the kernel in one go
+  if (fp) setvbuf(fp, nullptr, _IONBF, 0);
+  return fp;
 }
 
+// FileWriter batches lines into one of two buffers while a dedicated I/O
+// thread writes the other one out, so a slow disk only stalls the backend
+// once both buffers are full. Buffers and thread are set up on first Open.
+class FileWriter {
+ public:
+  explicit FileWriter(size_t capacity) : capacity_(capacity) {}
+
+  ~FileWriter() {
+    Close();
+    if (!thread_.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    thread_.join();
+  }
+
+  bool Open(const std::string &path) {
+    Close();
+    if (!thread_.joinable()) {
+      buffers_[0].reset(new char[capacity_]);
+      buffers_[1].reset(new char[capacity_]);
+      active_ = buffers_[0].get();
+      thread_ = std::thread(&FileWriter::loop, this);
+    }
+    fp_ = openFile(path);
+    if (!fp_) return false;
+    fseek(fp_, 0, SEEK_END);
+    long size = ftell(fp_);
+    size_ = size > 0 ? static_cast<size_t>(size) : 0;
+    path_ = path;
+    open_ = true;
+    return true;
+  }
+
+  bool IsOpen() const { return open_; }
+
+  // bytes the file held when it was opened
+  size_t Size() const { return size_; }
+
+  void Close() {
+    if (!open_) return;
+    Sync();
+    if (fp_) fclose(fp_);
+    fp_ = nullptr;
+    open_ = false;
+  }
+
+  void Append(const char *data, size_t size) {
+    if (!open_) return;
+    if (cursor_ + size > capacity_) {
+      Flush();
+      if (size > capacity_) {
+        Sync();
+        if (fp_) fwrite(data, size, 1, fp_);
+        return;
+      }
+    }
+    memcpy(active_ + cursor_, data, size);
+    cursor_ += size;
+  }
+
+  // hands the active buffer to the I/O thread without waiting for the write
+  void Flush() {
+    if (cursor_ == 0) return;
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return pending_ == nullptr; });
+    pending_ = active_;
+    pending_size_ = cursor_;
+    active_ = active_ == buffers_[0].get() ? buffers_[1].get() : buffers_[0].get();
+    cursor_ = 0;
+    lock.unlock();
+    cond_.notify_all();
+  }
+
+  // returns once everything appended so far has reached the file
+  void Sync() {
+    Flush();
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return pending_ == nullptr && !roll_; });
+    if (fp_) fflush(fp_);
+  }
+
+  // once the lines appended so far are written, the I/O thread closes the
+  // file, runs roll to rename it away and continues in path
+  void Rotate(std::function<void()> roll, std::string path) {
+    if (!open_) return;
+    Flush();
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return !roll_; });
+    roll_ = std::move(roll);
+    roll_path_ = std::move(path);
+    lock.unlock();
+    cond_.notify_all();
+  }
+
+ private:
+  void loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cond_.wait(lock, [this] { return pending_ != nullptr || roll_ || stop_; });
+      if (pending_) {
+        lock.unlock();
+        if (fp_) fwrite(pending_, pending_size_, 1, fp_);
+        lock.lock();
+        pending_ = nullptr;
+        cond_.notify_all();
+      }
+      if (roll_) {
+        std::function<void()> roll = roll_;
+        path_ = roll_path_;
+        lock.unlock();
+        if (fp_) fclose(fp_);
+        roll();
+        fp_ = openFile(path_);
+        lock.lock();
+        roll_ = nullptr;
+        cond_.notify_all();
+      } else if (!pending_ && stop_) {
+        return;
+      }
+    }
+  }
+
+  const size_t capacity_;
+  std::unique_ptr<char[]> buffers_[2];
+  // owned by the I/O thread while it is busy, by the backend otherwise
+  FILE *fp_{nullptr};
+  std::string path_;
+  // backend side
+  bool open_{false};
+  size_t size_{0};
+  char *active_{nullptr};
+  size_t cursor_{0};
+  // handed to the I/O thread, guarded by mutex_
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  const char *pending_{nullptr};
+  size_t pending_size_{0};
+  std::function<void()> roll_;
+  std::string roll_path_;
+  bool stop_{false};
+  std::thread thread_;
+};
+
+// Compressor gzips rotated files one after another on a low priority thread,
+// so compression never holds up the backend or the I/O thread.
+class Compressor {
+ public:
+  Compressor() : thread_(&Compressor::loop, this) {}
+
+  // jobs already posted still run before the thread exits
+  ~Compressor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    thread_.join();
+  }
+
+  void Post(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back(std::move(job));
+    }
+    cond_.notify_all();
+  }
+
+ private:
+  void loop() {
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#endif
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cond_.wait(lock, [this] { return !jobs_.empty() || stop_; });
+      if (jobs_.empty()) return;
+      std::function<void()> job = std::move(jobs_.front());
+      jobs_.pop_front();
+      lock.unlock();
+      job();
+      lock.lock();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::function<void()>> jobs_;
+  bool stop_{false};
+  std::thread thread_;
+};
+
+struct Mole::Producer {
+  Ring<Meta> ring{META_RING_SIZE};
+  // set when the owning thread exits, the backend drops the ring once drained
+  std::atomic<bool> retired{false};
+  // lives as long as the ring, so records can point to it
+  Thread thread;
+};
+
+// the id the OS shows for the calling thread
+static uint64_t currentThreadId() {
+#ifdef _WIN32
+  return GetCurrentThreadId();
+#elif defined(__linux__)
+  return static_cast<uint64_t>(syscall(SYS_gettid));
+#elif defined(__APPLE__)
+  uint64_t id = 0;
+  pthread_threadid_np(nullptr, &id);
+  return id;
+#else
+  return std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+}
+
+static void labelThread(Mole::Thread &thread) {
+  fmt::format_int id(thread.id);
+  thread.label.assign(id.data(), id.size());
+  if (thread.name.empty()) return;
+  thread.label += '(';
+  thread.label += thread.name;
+  thread.label += ')';
+}
+
+// TscClock maps time stamp counter readings to wall time. The mapping is
+// anchored at the latest (counter, system_clock) sample and its rate is
+// measured since the first one, so it sharpens as the process runs while
+// each recalibration follows adjustments of the wall clock.
+class TscClock {
+ public:
+  // the counter has to tick at a constant rate across power states
+  static bool Supported() {
+#if defined(MOLE_HAS_TSC) && (defined(_M_X64) || defined(_M_IX86))
+    int regs[4];
+    __cpuid(regs, 0x80000000);
+    if (static_cast<unsigned>(regs[0]) < 0x80000007u) return false;
+    __cpuid(regs, 0x80000007);
+    return (regs[3] >> 8) & 1;
+#elif defined(MOLE_HAS_TSC)
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+    return (edx >> 8) & 1;
+#else
+    return false;
+#endif
+  }
+
+  static uint64_t Now() {
+#ifdef MOLE_HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+  }
+
+  // blocks for kCALIBRATION to measure the rate the first time
+  void Calibrate() {
+    base_ = sample();
+    std::this_thread::sleep_for(kCALIBRATION);
+    anchor_ = sample();
+    ns_per_tick_ = rate(base_, anchor_);
+    period_ticks_ = static_cast<uint64_t>(1e9 / ns_per_tick_);
+  }
+
+  // takes a new anchor once a second has passed since the last one
+  void Recalibrate(uint64_t now) {
+    if (now - anchor_.ticks < period_ticks_) return;
+    Sample sample = this->sample();
+    double ns_per_tick = rate(base_, sample);
+    // the wall clock was stepped, measure from the last anchor instead
+    if (std::fabs(ns_per_tick / ns_per_tick_ - 1) > kMAX_DRIFT) {
+      base_ = anchor_;
+      ns_per_tick = rate(base_, sample);
+    }
+    ns_per_tick_ = ns_per_tick;
+    anchor_ = sample;
+  }
+
+  Mole::time_point ToTime(uint64_t ticks) const {
+    double delta = static_cast<double>(static_cast<int64_t>(ticks - anchor_.ticks)) * ns_per_tick_;
+    std::chrono::nanoseconds ns(anchor_.ns + static_cast<int64_t>(std::llround(delta)));
+    return Mole::time_point(std::chrono::duration_cast<Mole::time_point::duration>(ns));
+  }
+
+ private:
+  static constexpr std::chrono::milliseconds kCALIBRATION{10};
+  static constexpr double kMAX_DRIFT = 1e-4;
+  struct Sample {
+    uint64_t ticks;
+    int64_t ns;
+  };
+  Sample base_{}, anchor_{};
+  double ns_per_tick_{1};
+  uint64_t period_ticks_{0};
+
+  // the tightest of a few counter readings around a system_clock reading
+  static Sample sample() {
+    Sample best{};
+    uint64_t best_gap = UINT64_MAX;
+    for (int round = 0; round < 5; ++round) {
+      uint64_t before = Now();
+      auto time = std::chrono::system_clock::now();
+      uint64_t after = Now();
+      if (after - before < best_gap) {
+        best_gap = after - before;
+        best.ticks = before + (after - before) / 2;
+        best.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+      }
+    }
+    return best;
+  }
+  static double rate(const Sample &from, const Sample &to) {
+    return static_cast<double>(to.ns - from.ns) / static_cast<double>(to.ticks - from.ticks);
+  }
+};
+constexpr std::chrono::milliseconds TscClock::kCALIBRATION;
+
+static Mole::time_point coarseNow() {
+#ifdef CLOCK_REALTIME_COARSE
+  struct timespec ts{};
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  return Mole::time_point(std::chrono::duration_cast<Mole::time_point::duration>(
+      std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+#else
+  return std::chrono::system_clock::now();
+#endif
+}
+
+// a pending Flush(), done once every ring has been consumed past its mark
+struct Mole::Barrier {
+  std::vector<std::pair<std::shared_ptr<Producer>, size_t>> marks;
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool done{false};
+};
+
+// ring tag of operations, which are never dropped, records carry their level
+static constexpr uint8_t kKEEP = 0xFF;
+
+// empty polls the backend spins through, then yields through, before parking
+static constexpr size_t kSPIN_ROUNDS = 64;
+static constexpr size_t kYIELD_ROUNDS = 64;
+
+std::atomic<uint32_t> Mole::threshold_{static_cast<uint32_t>(Mole::Level::kTRACE)};
+
+Mole::Mole()
+    : console_sink_(std::make_shared<ConsoleSink>()), file_sink_(std::make_shared<FileSink>()),
+      pattern_(new Pattern(LINE_LAYOUT)) {}
+
 Mole::~Mole() {
   stop_ = true;
+  semaphore_.signal();
   thread_.join();
+  std::lock_guard<std::mutex> lock(sinks_mutex_);
+  sinks_cond_.notify_all();
+}
+
+Mole::Producer &Mole::producer() {
+  struct Holder {
+    Mole *mole{nullptr};
+    std::shared_ptr<Producer> producer;
+    ~Holder() {
+      if (producer) producer->retired.store(true, std::memory_order_release);
+    }
+  };
+  static thread_local Holder holder;
+  if (holder.mole != this) {
+    if (holder.producer) holder.producer->retired.store(true, std::memory_order_release);
+    holder.mole = this;
+    holder.producer = std::make_shared<Producer>();
+    holder.producer->thread.id = currentThreadId();
+    labelThread(holder.producer->thread);
+    std::lock_guard<std::mutex> lock(producers_mutex_);
+    producers_.push_back(holder.producer);
+    producers_dirty_.store(true, std::memory_order_release);
+  }
+  return *holder.producer;
 }
 
 void Mole::Log(Mole::Meta &&meta) {
-  if (!enable_ || meta.op == kNONE && meta.level < filter) return;
-  meta.time = std::chrono::system_clock::now();
-  meta.thread_id = std::this_thread::get_id();
-  meta_chan_.enqueue(std::move(meta));
+  if (meta.op == kNONE && !Enabled(meta.site->level)) return;
+  uint8_t tag = meta.op == kNONE ? static_cast<uint8_t>(meta.site->level) : kKEEP;
+  Meta *slot = reserve(tag);
+  if (!slot) return;
+  slot->site = meta.site;
+  slot->op = meta.op;
+  // copied rather than moved, the slot keeps its spill buffer for later records
+  slot->content.Assign(meta.content.View());
+  slot->render = meta.render;
+  slot->signature = meta.signature;
+  commit(tag);
+}
+Mole::Meta *Mole::reserve(uint8_t tag) {
+  Producer &self = producer();
+  Ring<Meta> &ring = self.ring;
+  Meta *slot;
+  while ((slot = ring.Reserve()) == nullptr) {
+    auto policy = static_cast<Overflow>(overflow_.load(std::memory_order_relaxed));
+    // only a record the backend has not claimed yet can be overwritten
+    if (policy == Overflow::kOVERWRITE && ring.Full()) {
+      uint8_t oldest = ring.OldestTag();
+      if (oldest != kKEEP && (slot = ring.Evict()) != nullptr) {
+        drop(oldest);
+        break;
+      }
+    }
+    // the slot may be held by a batch the backend is still writing, which
+    // takes as long as the slowest sink, so records do not wait for it
+    if (policy != Overflow::kBLOCK && tag != kKEEP) {
+      drop(tag);
+      return nullptr;
+    }
+    std::this_thread::yield();
+  }
+  slot->ticks = false;
+  switch (static_cast<Clock>(clock_.load(std::memory_order_acquire))) {
+    case Clock::kTSC:
+      slot->time = time_point(time_point::duration(static_cast<time_point::rep>(TscClock::Now())));
+      slot->ticks = true;
+      break;
+    case Clock::kCOARSE:
+      slot->time = coarseNow();
+      break;
+    default:
+      slot->time = std::chrono::system_clock::now();
+  }
+  slot->thread = &self.thread;
+  return slot;
+}
+void Mole::commit(uint8_t tag) {
+  producer().ring.Commit(tag);
+  wake();
+}
+void Mole::Prepare(size_t content_capacity) {
+  producer().ring.ForEach([content_capacity](Meta &meta) {
+    // writing the payload once faults its pages in now rather than on a hot path
+    meta.content.Resize(content_capacity);
+    memset(meta.content.Data(), 0, meta.content.Capacity());
+    meta.content.Resize(0);
+  });
+}
+void Mole::drop(uint8_t level) {
+  dropped_[level].fetch_add(1, std::memory_order_relaxed);
+  dropped_total_.fetch_add(1, std::memory_order_release);
+}
+void Mole::OnFull(Overflow policy) {
+  overflow_.store(static_cast<uint32_t>(policy), std::memory_order_relaxed);
+}
+uint64_t Mole::Dropped(Level level) const {
+  return dropped_[static_cast<size_t>(level)].load(std::memory_order_relaxed);
+}
+void Mole::wake() {
+  // without a full fence a wakeup can be missed, the timed park bounds the delay
+  if (parked_.load(std::memory_order_relaxed) && parked_.exchange(false, std::memory_order_acq_rel)) {
+    semaphore_.signal();
+  }
 }
 void Mole::Enable(bool is_enable) {
-  Log(Meta{Level::kSILENCE, is_enable ? Operation::kENABLE : Operation::kDISABLE});
+  if (is_enable) {
+    threshold_.fetch_and(~kDISABLED, std::memory_order_relaxed);
+  } else {
+    threshold_.fetch_or(kDISABLED, std::memory_order_relaxed);
+  }
 }
 void Mole::Console(bool is_console) {
-  Log(Meta{Level::kSILENCE, is_console ? Operation::kCONSOLE : Operation::kNCONSOLE});
+  Log(Meta{nullptr, is_console ? Operation::kCONSOLE : Operation::kNCONSOLE});
 }
 void Mole::Save(bool is_save, std::string path) {
-  Log(Meta{Level::kSILENCE, is_save ? Operation::kSAVE : Operation::kNSAVE, std::move(path)});
+  Log(Meta{nullptr, is_save ? Operation::kSAVE : Operation::kNSAVE, path});
+}
+void Mole::ThreadName(std::string name) {
+  Log(Meta{nullptr, kNAME, name});
+}
+Mole::Clock Mole::Timestamp(Clock clock) {
+  std::lock_guard<std::mutex> lock(clock_mutex_);
+  if (clock == Clock::kTSC && !TscClock::Supported()) clock = Clock::kCOARSE;
+#ifndef CLOCK_REALTIME_COARSE
+  if (clock == Clock::kCOARSE) clock = Clock::kSYSTEM;
+#endif
+  if (clock == Clock::kTSC && !tsc_) {
+    std::unique_ptr<TscClock> tsc(new TscClock);
+    tsc->Calibrate();
+    tsc_ = std::move(tsc);
+  }
+  clock_.store(static_cast<uint32_t>(clock), std::memory_order_release);
+  return clock;
+}
+void Mole::Latency(std::chrono::microseconds max_latency) {
+  max_latency_us_.store(max_latency.count(), std::memory_order_relaxed);
+}
+void Mole::Flush() {
+  Barrier barrier;
+  {
+    std::lock_guard<std::mutex> lock(producers_mutex_);
+    for (auto &producer : producers_) {
+      barrier.marks.emplace_back(producer, producer->ring.Tail());
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(barriers_mutex_);
+    barriers_.push_back(&barrier);
+    barriers_pending_.store(true, std::memory_order_release);
+  }
+  wake();
+  std::unique_lock<std::mutex> lock(barrier.mutex);
+  barrier.cond.wait(lock, [&barrier] { return barrier.done; });
+}
+void Mole::FlushOn(Mole::Level level) {
+  flush_level_.store(static_cast<uint32_t>(level), std::memory_order_relaxed);
+}
+void Mole::FlushEvery(std::chrono::milliseconds interval) {
+  flush_interval_ms_.store(interval.count(), std::memory_order_relaxed);
+}
+void Mole::AddSink(std::shared_ptr<Sink> sink) {
+  std::lock_guard<std::mutex> lock(sinks_mutex_);
+  sinks_.push_back(std::move(sink));
+  sinks_dirty_.store(true, std::memory_order_release);
+}
+void Mole::Layout(std::string pattern) {
+  std::lock_guard<std::mutex> lock(sinks_mutex_);
+  layout_ = pattern.empty() ? std::string(LINE_LAYOUT) : std::move(pattern);
+  layout_dirty_ = true;
+  sinks_dirty_.store(true, std::memory_order_release);
+}
+void Mole::RemoveSink(const std::shared_ptr<Sink> &sink) {
+  std::unique_lock<std::mutex> lock(sinks_mutex_);
+  sinks_.erase(std::remove(sinks_.begin(), sinks_.end(), sink), sinks_.end());
+  uint64_t version = ++sinks_version_;
+  sinks_dirty_.store(true, std::memory_order_release);
+  if (std::this_thread::get_id() == thread_.get_id()) return;
+  lock.unlock();
+  wake();
+  lock.lock();
+  sinks_cond_.wait(lock, [this, version] { return sinks_applied_ >= version || stop_; });
+}
+void Mole::Rotate(size_t max_size, size_t max_files) {
+  file_sink_->SetRotation(max_size, max_files);
+}
+void Mole::Rollover(std::chrono::seconds period) {
+  file_sink_->SetRollover(period);
+}
+void Mole::Compress(bool is_compress) {
+  file_sink_->SetCompression(is_compress);
 }
 void Mole::LogFilter(Mole::Level level) {
-  Log(Meta{level, Operation::kFILTER});
+  uint32_t threshold = threshold_.load(std::memory_order_relaxed);
+  while (!threshold_.compare_exchange_weak(threshold, (threshold & kDISABLED) | static_cast<uint32_t>(level),
+                                           std::memory_order_relaxed)) {}
 }
 
 void Mole::loop(Mole *m) {
@@ -80,138 +747,757 @@ void Mole::loop(Mole *m) {
   dwMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
   SetConsoleMode(hOut, dwMode);
 #endif
-  Meta meta[META_BULK_SIZE];
-  size_t num_read;
   Mole &mole = *m;
+  mole.refreshSinks();
+  std::vector<std::shared_ptr<Producer>> producers;
+  // takes at most META_BULK_SIZE records from every ring, returns how many
+  auto drain = [&mole, &producers]() {
+    if (mole.producers_dirty_.exchange(false, std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> lock(mole.producers_mutex_);
+      producers = mole.producers_;
+    }
+    size_t num_read = 0;
+    for (size_t index = 0; index < producers.size(); ++index) {
+      Producer &producer = *producers[index];
+      bool retired = producer.retired.load(std::memory_order_acquire);
+      size_t first = 0;
+      size_t count = producer.ring.Claim(META_BULK_SIZE, first);
+      for (size_t position = first; position != first + count; ++position) {
+        mole.writeMeta(std::move(producer.ring.At(position)));
+        producer.ring.Release(position);
+      }
+      num_read += count;
+      if (retired && count < META_BULK_SIZE) {
+        std::lock_guard<std::mutex> lock(mole.producers_mutex_);
+        auto it = std::find(mole.producers_.begin(), mole.producers_.end(), producers[index]);
+        if (it != mole.producers_.end()) mole.producers_.erase(it);
+        producers.erase(producers.begin() + static_cast<std::ptrdiff_t>(index--));
+      }
+    }
+    return num_read;
+  };
+  size_t idle = 0;
   while (!mole.stop_) {
-    if ((num_read = mole.meta_chan_.try_dequeue_bulk(meta, META_BULK_SIZE)) == 0) { continue; }
-    for (size_t index = 0; index < num_read; ++index) {
-      mole.writeMeta(std::move(meta[index]));
+    size_t num_read = drain();
+    mole.housekeep();
+    if (num_read != 0) {
+      idle = 0;
+      continue;
     }
-  }
-  while ((num_read = mole.meta_chan_.try_dequeue_bulk(meta, META_BULK_SIZE)) != 0) {
-    for (size_t index = 0; index < num_read; ++index) {
-      mole.writeMeta(std::move(meta[index]));
+    // every ring is empty, what the sinks gathered is a complete batch
+    mole.endBatch();
+    if (++idle < kSPIN_ROUNDS) { continue; }
+    if (idle < kSPIN_ROUNDS + kYIELD_ROUNDS) {
+      std::this_thread::yield();
+      continue;
     }
+    mole.parked_.store(true, std::memory_order_seq_cst);
+    if (drain() != 0) {
+      mole.parked_.store(false, std::memory_order_relaxed);
+      idle = 0;
+      continue;
+    }
+    mole.semaphore_.wait(mole.max_latency_us_.load(std::memory_order_relaxed));
+    mole.parked_.store(false, std::memory_order_relaxed);
   }
-  if (mole.fp) {
-    fwrite(mole.buffer, mole.cursor, 1, mole.fp);
-    mole.cursor = 0;
-    fclose(mole.fp);
-    mole.fp = nullptr;
+  while (drain() != 0) {}
+  mole.housekeep();
+  for (auto &sink : mole.active_sinks_) {
+    sink->Sync();
   }
+  mole.active_sinks_.clear();
+  mole.file_sink_->Close();
 
 }
 void Mole::writeMeta(Mole::Meta &&meta) {
   switch (meta.op) {
     case kNONE : {
-      if (!enable_ || !console_ && !save_) return;
-
-      auto duration = meta.time.time_since_epoch();
-      auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-      auto t_count = std::chrono::system_clock::to_time_t(meta.time);
-
-      std::stringstream time_stream, tid_stream;
-      time_stream << std::put_time(std::localtime(&t_count), "%Y-%m-%d %X")
-                  << '.' << std::setfill('0') << std::setw(6) << microseconds % 1000000;
-      tid_stream << meta.thread_id;
-
-      auto styled_str = fmt::format(
-          "{} [{:^7}] {} [{}:{} thread:{}]\n",
-          time_stream.str(),
-          fmt::styled(level_map[meta.level], fmt::bg(fmt::color::black) | fmt::fg(color_schema[meta.level])),
-          meta.content,
-          meta.file,
-          meta.line,
-          tid_stream.str()
-      );
-
-      if (console_) {
-        fmt::print(styled_str);
-      }
-
-      if (save_) {
-        if (!fp) {
-          fp = fopen(save_path_.c_str(), "ab");
-          if (!fp) {
-            save_ = false;
-            Log(Meta{Level::kFATAL, kNONE, fmt::format("open log file:{} failed!", meta.content), {}, __LINE__,
-                     __FILE__,
-                     {}});
-            return;
-          }
-        }
-        auto raw_str = std::regex_replace(styled_str, std::regex("\033\\[[0-9;]*m"), "");
-        if (cursor + raw_str.size() >= CACHE_BUF_SIZE) {
-          fwrite(buffer, cursor, 1, fp);
-          buffer[0] = '\0';
-          cursor = 0;
+      const Site &site = *meta.site;
+      if (meta.ticks) {
+        meta.time = tsc_->ToTime(static_cast<uint64_t>(meta.time.time_since_epoch().count()));
+        meta.ticks = false;
+      }
+      if (sinks_dirty_.load(std::memory_order_acquire)) refreshSinks();
+      bool plain = false, colored = false, raw = false, own = false;
+      for (auto &sink : active_sinks_) {
+        if (!sink->Accepts(site.level)) continue;
+        if (sink->layout_dirty_.load(std::memory_order_acquire)) sink->compileLayout();
+        switch (sink->LineStyle()) {
+          case Sink::Style::kPLAIN: (sink->pattern_ ? own : plain) = true; break;
+          case Sink::Style::kCOLORED: (sink->pattern_ ? own : colored) = true; break;
+          case Sink::Style::kRAW: raw = true; break;
         }
-        if (raw_str.size() > CACHE_BUF_SIZE) {
-          fwrite(raw_str.c_str(), raw_str.size(), 1, fp);
+      }
+      if (!plain && !colored && !raw && !own) return;
+
+      line_buf_.clear();
+      console_buf_.clear();
+      fmt::string_view content = meta.content.View();
+      if ((plain || colored || own) && meta.render) {
+        text_buf_.clear();
+        meta.render(text_buf_, site.format, meta.content.Data());
+        content = {text_buf_.data(), text_buf_.size()};
+      }
+      // the plain and the colored line are rendered in one pass
+      if (plain || colored) {
+        pattern_->Format(meta, content, plain ? &line_buf_ : nullptr, colored ? &console_buf_ : nullptr);
+      }
+
+      bool flush = static_cast<uint32_t>(site.level) >= flush_level_.load(std::memory_order_relaxed);
+      for (auto &sink : active_sinks_) {
+        if (!sink->Accepts(site.level)) continue;
+        Sink::Style style = sink->LineStyle();
+        if (sink->pattern_ && style != Sink::Style::kRAW) {
+          sink_buf_.clear();
+          sink->pattern_->Format(meta, content, style == Sink::Style::kPLAIN ? &sink_buf_ : nullptr,
+                                 style == Sink::Style::kCOLORED ? &sink_buf_ : nullptr);
+          sink->Write(meta, {sink_buf_.data(), sink_buf_.size()});
         } else {
-          strcat(buffer, raw_str.c_str());
-          cursor += raw_str.size();
+          switch (style) {
+            case Sink::Style::kPLAIN: sink->Write(meta, {line_buf_.data(), line_buf_.size()}); break;
+            case Sink::Style::kCOLORED: sink->Write(meta, {console_buf_.data(), console_buf_.size()}); break;
+            case Sink::Style::kRAW: sink->Write(meta, {}); break;
+          }
         }
+        if (flush) sink->Flush();
+      }
+      batched_ = true;
+      if (!flush && !unflushed_) {
+        unflushed_ = true;
+        flush_deadline_ = std::chrono::steady_clock::now()
+            + std::chrono::milliseconds(flush_interval_ms_.load(std::memory_order_relaxed));
       }
-
-      break;
-    }
-    case kENABLE: {
-      enable_ = true;
-      break;
-    }
-    case kDISABLE: {
-      enable_ = false;
       break;
     }
     case kCONSOLE: {
       console_ = true;
+      refreshSinks();
       break;
     }
     case kNCONSOLE: {
       console_ = false;
+      console_sink_->Flush();
+      refreshSinks();
       break;
     }
     case kSAVE: {
       save_ = true;
-      if (save_path_ != meta.content) {
-        if (fp) {
-          fclose(fp);
-        }
-        fp = fopen(meta.content.c_str(), "ab");
-        if (!fp) {
+      std::string path(meta.content.Data(), meta.content.Size());
+      if (file_sink_->Path() != path || !file_sink_->IsOpen()) {
+        if (!file_sink_->Open(path)) {
           save_ = false;
-          Log(Meta{Level::kFATAL, kNONE, fmt::format("open log file:{} failed!", meta.content), {}, __LINE__, __FILE__,
-                   {}});
+          static const Site site{Level::kFATAL, __LINE__, FILENAME(__FILE__), __func__, nullptr};
+          Log(Meta{&site, kNONE, fmt::format("open log file:{} failed!", path)});
         }
       }
+      refreshSinks();
+      break;
+    }
+    case kNAME: {
+      meta.thread->name.assign(meta.content.Data(), meta.content.Size());
+      labelThread(*meta.thread);
       break;
     }
     case kNSAVE: {
       save_ = false;
+      file_sink_->Flush();
+      refreshSinks();
       break;
     }
-    case kFILTER: {
-      filter = meta.level;
-      break;
+  }
+}
+
+void Mole::endBatch() {
+  if (!batched_) return;
+  batched_ = false;
+  for (auto &sink : active_sinks_) {
+    sink->EndBatch();
+  }
+}
+void Mole::refreshSinks() {
+  sinks_dirty_.store(false, std::memory_order_relaxed);
+  // sinks about to be dropped still get what they gathered so far
+  endBatch();
+  active_sinks_.clear();
+  if (console_) active_sinks_.push_back(console_sink_);
+  if (save_) active_sinks_.push_back(file_sink_);
+  std::lock_guard<std::mutex> lock(sinks_mutex_);
+  active_sinks_.insert(active_sinks_.end(), sinks_.begin(), sinks_.end());
+  if (layout_dirty_) {
+    pattern_.reset(new Pattern(layout_));
+    layout_dirty_ = false;
+  }
+  if (sinks_applied_ != sinks_version_) {
+    sinks_applied_ = sinks_version_;
+    sinks_cond_.notify_all();
+  }
+}
+
+static const char kDIGITS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static inline void write2(char *out, unsigned value) {
+  memcpy(out, kDIGITS + value * 2, 2);
+}
+
+void Mole::housekeep() {
+  // without records to write the sink list would otherwise stay stale, and
+  // a removed sink would still be flushed
+  if (sinks_dirty_.load(std::memory_order_acquire)) refreshSinks();
+  if (dropped_total_.load(std::memory_order_acquire) != reported_total_) reportDrops();
+  if (clock_.load(std::memory_order_acquire) == static_cast<uint32_t>(Clock::kTSC)) {
+    tsc_->Recalibrate(TscClock::Now());
+  }
+  if (unflushed_ && std::chrono::steady_clock::now() >= flush_deadline_) {
+    for (auto &sink : active_sinks_) {
+      sink->Flush();
     }
+    unflushed_ = false;
   }
+  if (!barriers_pending_.load(std::memory_order_acquire)) return;
+  std::lock_guard<std::mutex> lock(barriers_mutex_);
+  for (auto it = barriers_.begin(); it != barriers_.end();) {
+    Barrier &barrier = **it;
+    bool reached = std::all_of(barrier.marks.begin(), barrier.marks.end(),
+                               [](const std::pair<std::shared_ptr<Producer>, size_t> &mark) {
+                                 return mark.first->ring.Head() >= mark.second;
+                               });
+    if (!reached) {
+      ++it;
+      continue;
+    }
+    for (auto &sink : active_sinks_) {
+      sink->Sync();
+    }
+    unflushed_ = false;
+    it = barriers_.erase(it);
+    // notify under the lock, the waiter owns the barrier and may return at once
+    std::lock_guard<std::mutex> barrier_lock(barrier.mutex);
+    barrier.done = true;
+    barrier.cond.notify_all();
+  }
+  barriers_pending_.store(!barriers_.empty(), std::memory_order_relaxed);
+}
+
+// writes one WARN record with the drops per level since the last report
+void Mole::reportDrops() {
+  auto now = std::chrono::steady_clock::now();
+  if (now < report_deadline_) return;
+  report_deadline_ = now + std::chrono::milliseconds(DROP_REPORT_MS);
+  reported_total_ = dropped_total_.load(std::memory_order_acquire);
+  uint64_t total = 0;
+  fmt::memory_buffer levels;
+  for (size_t level = 0; level < kLEVELS; ++level) {
+    uint64_t dropped = dropped_[level].load(std::memory_order_relaxed);
+    uint64_t count = dropped - reported_[level];
+    reported_[level] = dropped;
+    if (count == 0) continue;
+    fmt::format_to(fmt::appender(levels), "{}{} {}", total == 0 ? "" : ", ", count, LevelName(static_cast<Level>(level)));
+    total += count;
+  }
+  if (total == 0 || !Enabled(Level::kWARN)) return;
+  static const Site site{Level::kWARN, __LINE__, FILENAME(__FILE__), __func__, nullptr};
+  // the backend labels its own records without setting up a ring it never logs through
+  static Thread backend = [] {
+    Thread thread;
+    thread.id = currentThreadId();
+    labelThread(thread);
+    return thread;
+  }();
+  Meta meta{&site, kNONE, fmt::format("{} messages dropped: {}", total, fmt::string_view{levels.data(), levels.size()})};
+  meta.time = std::chrono::system_clock::now();
+  meta.thread = &backend;
+  writeMeta(std::move(meta));
+}
+
+const char *Mole::LevelName(Level level) {
+  auto index = static_cast<size_t>(level);
+  return index < sizeof(kLEVEL_NAMES) / sizeof(kLEVEL_NAMES[0]) ? kLEVEL_NAMES[index].data : "";
 }
+
 Mole &Mole::Instance() {
   static Mole mole;
   return mole;
 }
 
-Mole::Meta::Meta(Mole::Level level_,
-                 Mole::Operation op_,
-                 std::string content_,
-                 std::thread::id thread_id_,
-                 uint32_t line_,
-                 const char *file_,
-                 Mole::time_point time_) :
-    level(level_), op(op_), content(std::move(content_)), thread_id(thread_id_), line(line_), file(file_), time(time_) {
+static void append(fmt::memory_buffer *out, const char *data, size_t size) {
+  if (out) out->append(data, data + size);
+}
+static void append(fmt::memory_buffer *out, const Text &text) {
+  append(out, text.data, text.size);
+}
+
+Pattern::Pattern(const std::string &pattern) : source_(pattern) {
+  std::vector<Step> steps;
+  auto text = [this, &steps](const char *data, size_t size) {
+    if (steps.empty() || steps.back().field != Field::kTEXT) {
+      steps.push_back({Field::kTEXT, static_cast<uint32_t>(text_.size()), 0});
+    }
+    text_.append(data, size);
+    steps.back().size += static_cast<uint32_t>(size);
+  };
+  for (size_t index = 0; index < pattern.size(); ++index) {
+    if (pattern[index] != '%' || index + 1 == pattern.size()) {
+      text(&pattern[index], 1);
+      continue;
+    }
+    Field field;
+    switch (pattern[++index]) {
+      case 'Y': field = Field::kYEAR; break;
+      case 'm': field = Field::kMONTH; break;
+      case 'd': field = Field::kDAY; break;
+      case 'H': field = Field::kHOUR; break;
+      case 'M': field = Field::kMINUTE; break;
+      case 'S': field = Field::kSECOND; break;
+      case 'e': field = Field::kMILLI; break;
+      case 'f': field = Field::kMICRO; break;
+      case 'l': field = Field::kLEVEL; break;
+      case 'L': field = Field::kTAG; break;
+      case 'v': field = Field::kMESSAGE; break;
+      case 's': field = Field::kFILE; break;
+      case '#': field = Field::kLINE; break;
+      case '!': field = Field::kFUNCTION; break;
+      case 't': field = Field::kTHREAD; break;
+      case '%': text("%", 1); continue;
+      default: text(&pattern[index - 1], 2); continue;
+    }
+    steps.push_back({field, 0, 0});
+  }
+  text("\n", 1);
+
+  // runs of date and time fields and the text between them become one clock
+  auto per_second = [](Field field) { return field >= Field::kYEAR && field <= Field::kSECOND; };
+  for (size_t index = 0; index < steps.size();) {
+    size_t end = index;
+    bool timed = false;
+    while (end < steps.size() && (steps[end].field == Field::kTEXT || per_second(steps[end].field))) {
+      timed = timed || per_second(steps[end].field);
+      ++end;
+    }
+    if (!timed) {
+      steps_.push_back(steps[index++]);
+      continue;
+    }
+    clocks_.push_back({std::vector<Step>(steps.begin() + index, steps.begin() + end), std::string()});
+    steps_.push_back({Field::kCLOCK, static_cast<uint32_t>(clocks_.size() - 1), 0});
+    index = end;
+  }
+}
+
+void Pattern::renderClocks(int64_t second) {
+  time_t t_count = static_cast<time_t>(second);
+  struct tm tm{};
+#ifdef _WIN32
+  localtime_s(&tm, &t_count);
+#else
+  localtime_r(&t_count, &tm);
+#endif
+  for (Clock &clock : clocks_) {
+    clock.text.clear();
+    char digits[2];
+    for (const Step &step : clock.steps) {
+      switch (step.field) {
+        case Field::kTEXT: clock.text.append(text_, step.begin, step.size); continue;
+        case Field::kYEAR: clock.text += fmt::format_int(tm.tm_year + 1900).c_str(); continue;
+        case Field::kMONTH: write2(digits, static_cast<unsigned>(tm.tm_mon + 1)); break;
+        case Field::kDAY: write2(digits, static_cast<unsigned>(tm.tm_mday)); break;
+        case Field::kHOUR: write2(digits, static_cast<unsigned>(tm.tm_hour)); break;
+        case Field::kMINUTE: write2(digits, static_cast<unsigned>(tm.tm_min)); break;
+        // a leap second shows up as 60
+        case Field::kSECOND: write2(digits, static_cast<unsigned>(tm.tm_sec)); break;
+        default: continue;
+      }
+      clock.text.append(digits, 2);
+    }
+  }
+  second_ = second;
+}
+
+void Pattern::Format(const Mole::Meta &meta, fmt::string_view message,
+                     fmt::memory_buffer *plain, fmt::memory_buffer *colored) {
+  auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(meta.time.time_since_epoch()).count();
+  // rounded down, so a time before the epoch still has a fraction in [0, 1s)
+  int64_t second = microseconds / 1000000;
+  int64_t remainder = microseconds % 1000000;
+  if (remainder < 0) {
+    remainder += 1000000;
+    --second;
+  }
+  unsigned fraction = static_cast<unsigned>(remainder);
+  if (second != second_ && !clocks_.empty()) renderClocks(second);
+  const Mole::Site &site = *meta.site;
+  auto level = static_cast<size_t>(site.level);
+  for (const Step &step : steps_) {
+    switch (step.field) {
+      case Field::kTEXT:
+        append(plain, text_.data() + step.begin, step.size);
+        append(colored, text_.data() + step.begin, step.size);
+        break;
+      case Field::kCLOCK: {
+        const std::string &text = clocks_[step.begin].text;
+        append(plain, text.data(), text.size());
+        append(colored, text.data(), text.size());
+        break;
+      }
+      case Field::kMILLI:
+      case Field::kMICRO: {
+        char digits[6];
+        write2(digits, fraction / 10000);
+        write2(digits + 2, fraction / 100 % 100);
+        write2(digits + 4, fraction % 100);
+        size_t size = step.field == Field::kMILLI ? 3 : 6;
+        append(plain, digits, size);
+        append(colored, digits, size);
+        break;
+      }
+      case Field::kLEVEL:
+      case Field::kTAG: {
+        const Text &name = step.field == Field::kLEVEL ? kLEVEL_NAMES[level] : kLEVEL_TAGS[level];
+        append(plain, name);
+        if (!colored) break;
+        append(colored, kLEVEL_COLORS[level]);
+        append(colored, name);
+        append(colored, kCOLOR_RESET);
+        break;
+      }
+      case Field::kMESSAGE:
+        append(plain, message.data(), message.size());
+        append(colored, message.data(), message.size());
+        break;
+      case Field::kFILE:
+      case Field::kFUNCTION: {
+        const char *text = step.field == Field::kFILE ? site.file : site.function;
+        size_t size = strlen(text);
+        append(plain, text, size);
+        append(colored, text, size);
+        break;
+      }
+      case Field::kLINE: {
+        fmt::format_int line(site.line);
+        append(plain, line.data(), line.size());
+        append(colored, line.data(), line.size());
+        break;
+      }
+      case Field::kTHREAD: {
+        const std::string &label = meta.thread->label;
+        append(plain, label.data(), label.size());
+        append(colored, label.data(), label.size());
+        break;
+      }
+      default: break;
+    }
+  }
+}
+
+Sink::Sink(Mole::Level level, Style style) : level_(static_cast<uint32_t>(level)), style_(style) {}
+void Sink::SetLayout(std::string pattern) {
+  std::lock_guard<std::mutex> lock(layout_mutex_);
+  layout_ = std::move(pattern);
+  layout_dirty_.store(true, std::memory_order_release);
+}
+void Sink::compileLayout() {
+  std::lock_guard<std::mutex> lock(layout_mutex_);
+  layout_dirty_.store(false, std::memory_order_relaxed);
+  if (layout_.empty()) {
+    pattern_.reset();
+  } else {
+    pattern_.reset(new Pattern(layout_));
+  }
+}
+
+ConsoleSink::ConsoleSink(Mole::Level level, bool colored)
+    : Sink(level, colored ? Style::kCOLORED : Style::kPLAIN) {}
+ConsoleSink::~ConsoleSink() {
+  EndBatch();
+}
+void ConsoleSink::Write(const Mole::Meta &, fmt::string_view line) {
+  batch_.append(line.data(), line.data() + line.size());
+  if (batch_.size() >= CONSOLE_BATCH_SIZE) EndBatch();
+}
+void ConsoleSink::Flush() {
+  EndBatch();
+}
+void ConsoleSink::EndBatch() {
+  if (batch_.size() == 0) return;
+  // whatever the program printed through stdio itself goes out first
+  fflush(stdout);
+#ifdef _WIN32
+  fwrite(batch_.data(), 1, batch_.size(), stdout);
+  fflush(stdout);
+#else
+  const char *data = batch_.data();
+  size_t left = batch_.size();
+  while (left != 0) {
+    ssize_t written = write(STDOUT_FILENO, data, left);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      // a closed or non-blocking stdout that is full loses the batch
+      break;
+    }
+    data += written;
+    left -= static_cast<size_t>(written);
+  }
+#endif
+  batch_.clear();
+}
+
+FileSink::FileSink(Mole::Level level) : Sink(level), writer_(new FileWriter(CACHE_BUF_SIZE)) {}
+FileSink::FileSink(const std::string &path, Mole::Level level) : FileSink(level) {
+  Open(path);
+}
+FileSink::~FileSink() = default;
+bool FileSink::Open(const std::string &path) {
+  path_ = path;
+  time_t now = time(nullptr);
+  file_path_ = expandPath(path_, now);
+  rollover_at_ = nextRollover(now);
+  if (!writer_->Open(file_path_)) return false;
+  written_ = writer_->Size();
+  return true;
+}
+void FileSink::Close() {
+  writer_->Close();
+}
+bool FileSink::IsOpen() const {
+  return writer_->IsOpen();
+}
+void FileSink::Write(const Mole::Meta &meta, fmt::string_view line) {
+  if (reschedule_.load(std::memory_order_relaxed)) {
+    reschedule_.store(false, std::memory_order_relaxed);
+    rollover_at_ = nextRollover(std::chrono::system_clock::to_time_t(meta.time));
+  }
+  if (meta.time >= rollover_at_) {
+    rollover(std::chrono::system_clock::to_time_t(meta.time));
+  }
+  writer_->Append(line.data(), line.size());
+  written_ += line.size();
+  size_t max_size = max_size_.load(std::memory_order_relaxed);
+  if (max_size != 0 && written_ >= max_size) {
+    rotate();
+  }
+}
+void FileSink::SetRotation(size_t max_size, size_t max_files) {
+  max_files_.store(max_files, std::memory_order_relaxed);
+  max_size_.store(max_size, std::memory_order_relaxed);
+}
+
+// "dir/Mole.log" rotates to "dir/Mole.1.log", a path without extension gets ".1"
+static std::string rotatedPath(const std::string &path, size_t index) {
+  size_t base = path.find_last_of("/\\");
+  size_t dot = path.rfind('.');
+  if (dot == std::string::npos || (base != std::string::npos && dot < base) || dot == base + 1) {
+    return fmt::format("{}.{}", path, index);
+  }
+  return fmt::format("{}.{}{}", path.substr(0, dot), index, path.substr(dot));
+}
+
+void FileSink::SetRollover(std::chrono::seconds period) {
+  period_.store(period.count(), std::memory_order_relaxed);
+  reschedule_.store(true, std::memory_order_relaxed);
+}
+
+std::string FileSink::expandPath(const std::string &pattern, time_t time) {
+  if (pattern.find('%') == std::string::npos) return pattern;
+  struct tm tm{};
+#ifdef _WIN32
+  localtime_s(&tm, &time);
+#else
+  localtime_r(&time, &tm);
+#endif
+  char path[1024];
+  size_t size = strftime(path, sizeof(path), pattern.c_str(), &tm);
+  return size == 0 ? pattern : std::string(path, size);
+}
+
+// periods are counted from local midnight, so hourly files roll on the hour
+Mole::time_point FileSink::nextRollover(time_t time) const {
+  int64_t period = period_.load(std::memory_order_relaxed);
+  if (period <= 0) return Mole::time_point::max();
+  struct tm tm{};
+#ifdef _WIN32
+  localtime_s(&tm, &time);
+#else
+  localtime_r(&time, &tm);
+#endif
+  int64_t since_midnight = tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+  int64_t next = since_midnight - since_midnight % period + period;
+  tm.tm_hour = 0;
+  tm.tm_min = 0;
+  tm.tm_sec = static_cast<int>(next);
+  tm.tm_isdst = -1;
+  return std::chrono::system_clock::from_time_t(mktime(&tm));
+}
+
+void FileSink::SetCompression(bool is_compress) {
+  if (is_compress && !compressor_) {
+    compressor_.reset(new Compressor);
+  }
+  compress_.store(is_compress, std::memory_order_release);
+}
+
+// moves <name>.i<ext> and its .gz archive to i + 1, dropping the oldest
+static void shiftRotated(const std::string &path, size_t max_files) {
+  remove(rotatedPath(path, max_files).c_str());
+  remove((rotatedPath(path, max_files) + ".gz").c_str());
+  for (size_t index = max_files - 1; index > 0; --index) {
+    rename(rotatedPath(path, index).c_str(), rotatedPath(path, index + 1).c_str());
+    rename((rotatedPath(path, index) + ".gz").c_str(), (rotatedPath(path, index + 1) + ".gz").c_str());
+  }
+}
+
+void FileSink::rollover(time_t time) {
+  rollover_at_ = nextRollover(time);
+  std::string file_path = expandPath(path_, time);
+  if (file_path == file_path_) {
+    // nothing in the name changes with time, shift the old files instead
+    rotate();
+    return;
+  }
+  Compressor *compressor = compress_.load(std::memory_order_acquire) ? compressor_.get() : nullptr;
+  std::string old_path = std::move(file_path_);
+  file_path_ = std::move(file_path);
+  written_ = 0;
+  writer_->Rotate([compressor, old_path]() {
+    if (!compressor) return;
+    compressor->Post([old_path]() {
+      if (GzipFile(old_path, old_path + ".gz")) remove(old_path.c_str());
+    });
+  }, file_path_);
+}
+
+void FileSink::rotate() {
+  written_ = 0;
+  std::string path = file_path_;
+  size_t max_files = max_files_.load(std::memory_order_relaxed);
+  Compressor *compressor = compress_.load(std::memory_order_acquire) ? compressor_.get() : nullptr;
+  // a unique name to park the file under while it is being compressed
+  std::string parked = fmt::format("{}.{}.tmp", path, ++rotations_);
+  writer_->Rotate([path, max_files, compressor, parked]() {
+    if (max_files == 0) {
+      remove(path.c_str());
+      return;
+    }
+    if (!compressor) {
+      shiftRotated(path, max_files);
+      rename(path.c_str(), rotatedPath(path, 1).c_str());
+      return;
+    }
+    rename(path.c_str(), parked.c_str());
+    compressor->Post([path, max_files, parked]() {
+      // archives are only shifted here, so they stay in order behind slow compressions
+      bool compressed = GzipFile(parked, parked + ".gz");
+      shiftRotated(path, max_files);
+      if (compressed) {
+        rename((parked + ".gz").c_str(), (rotatedPath(path, 1) + ".gz").c_str());
+        remove(parked.c_str());
+      } else {
+        rename(parked.c_str(), rotatedPath(path, 1).c_str());
+      }
+    });
+  }, file_path_);
+}
+void FileSink::Flush() {
+  writer_->Flush();
+}
+void FileSink::Sync() {
+  writer_->Sync();
+}
+
+BinarySink::BinarySink(Mole::Level level)
+    : Sink(level, Style::kRAW), writer_(new FileWriter(CACHE_BUF_SIZE)) {}
+BinarySink::BinarySink(const std::string &path, Mole::Level level) : BinarySink(level) {
+  Open(path);
+}
+BinarySink::~BinarySink() = default;
+bool BinarySink::Open(const std::string &path) {
+  if (!writer_->Open(path)) return false;
+  sites_.clear();
+  threads_.clear();
+  thread_ids_ = 0;
+  last_us_ = 0;
+  writeHeader();
+  return true;
+}
+void BinarySink::Close() {
+  writer_->Close();
+}
+bool BinarySink::IsOpen() const {
+  return writer_->IsOpen();
+}
+void BinarySink::writeHeader() {
+  frame_.clear();
+  frame_.append(binary::kMAGIC, binary::kMAGIC + sizeof(binary::kMAGIC));
+  frame_.push_back(static_cast<char>(binary::kVERSION));
+  frame_.push_back(binary::LittleEndian() ? 1 : 0);
+  frame_.push_back(static_cast<char>(sizeof(size_t)));
+  frame_.push_back(static_cast<char>(sizeof(void *)));
+  writer_->Append(frame_.data(), frame_.size());
+}
+void BinarySink::Write(const Mole::Meta &meta, fmt::string_view) {
+  if (!writer_->IsOpen()) return;
+  // records formatted eagerly, or with arguments only this program can
+  // format, are stored as their text under a "{}" format
+  const Mole::Site &site = *meta.site;
+  bool packed = meta.render && !strchr(meta.signature, '?');
+  frame_.clear();
+
+  auto site_it = sites_.find(&site);
+  if (site_it == sites_.end()) {
+    site_it = sites_.emplace(&site, sites_.size()).first;
+    frame_.push_back(binary::kSITE);
+    binary::PutVarint(frame_, site_it->second);
+    frame_.push_back(static_cast<char>(site.level));
+    binary::PutVarint(frame_, site.line);
+    binary::PutString(frame_, site.file ? site.file : "");
+    binary::PutString(frame_, site.function ? site.function : "");
+    binary::PutString(frame_, packed ? site.format : "{}");
+    binary::PutString(frame_, packed ? meta.signature : "s");
+  }
+  std::pair<uint64_t, std::string> &thread = threads_[meta.thread];
+  if (thread.second.empty() || thread.second != meta.thread->label) {
+    thread.first = thread_ids_++;
+    thread.second = meta.thread->label;
+    frame_.push_back(binary::kTHREAD);
+    binary::PutVarint(frame_, thread.first);
+    binary::PutString(frame_, thread.second);
+  }
+
+  int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(meta.time.time_since_epoch()).count();
+  frame_.push_back(binary::kRECORD);
+  binary::PutVarint(frame_, site_it->second);
+  binary::PutVarint(frame_, binary::ZigZag(us - last_us_));
+  binary::PutVarint(frame_, thread.first);
+  last_us_ = us;
+  if (packed) {
+    binary::PutVarint(frame_, meta.content.Size());
+    frame_.append(meta.content.Data(), meta.content.Data() + meta.content.Size());
+  } else {
+    fmt::string_view text = meta.content.View();
+    if (meta.render) {
+      text_.clear();
+      meta.render(text_, site.format, meta.content.Data());
+      text = {text_.data(), text_.size()};
+    }
+    binary::PutVarint(frame_, detail::StringCodec::Size(text));
+    size_t at = frame_.size();
+    frame_.resize(at + detail::StringCodec::Size(text));
+    char *cursor = frame_.data() + at;
+    detail::StringCodec::Encode(cursor, text);
+  }
+  writer_->Append(frame_.data(), frame_.size());
+}
+void BinarySink::Flush() {
+  writer_->Flush();
+}
+void BinarySink::Sync() {
+  writer_->Sync();
+}
 
+Mole::Meta::Meta(const Site *site_, Operation op_, fmt::string_view content_) :
+    site(site_), op(op_) {
+  content.Assign(content_);
 }
 
 } // hzd
\ No newline at end of file
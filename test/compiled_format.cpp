@@ -0,0 +1,77 @@
+/**
+  ******************************************************************************
+  * @file           : compiled_format.cpp
+  * @author         : agent
+  * @brief          : Checks that the MOLE_*_C macros log what the plain ones do
+  * @date           : 2026/10/17
+  ******************************************************************************
+  */
+
+#include <Mole.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static const char *kPATH = "tmp.compiled_format.log";
+
+// the message of a line, between the level and the site
+static std::string message(const std::string &line) {
+  size_t begin = line.find("] ");
+  size_t end = line.rfind(" [");
+  if (begin == std::string::npos || end == std::string::npos || end < begin + 2) return line;
+  return line.substr(begin + 2, end - begin - 2);
+}
+
+int main() {
+  std::remove(kPATH);
+  MOLE_CONSOLE(false);
+  MOLE_SAVE(true, kPATH);
+
+  std::string text = "text";
+  const char *literal = "literal";
+  // every statement is logged once compiled and once as is, next to each other
+  for (int round = 0; round < 3; ++round) {
+    MOLE_INFO_C("plain");
+    MOLE_INFO("plain");
+    MOLE_WARN_C("{} {:.3f} {:>6} {:#x} {}", round, round * 0.25, text, round * 255u, literal);
+    MOLE_WARN("{} {:.3f} {:>6} {:#x} {}", round, round * 0.25, text, round * 255u, literal);
+    MOLE_ERROR_C("{1} before {0} {2}", round, 'c', true);
+    MOLE_ERROR("{1} before {0} {2}", round, 'c', true);
+    MOLE_FATAL_C("{} {}", std::string(200, 'x'), static_cast<const void *>(nullptr));
+    MOLE_FATAL("{} {}", std::string(200, 'x'), static_cast<const void *>(nullptr));
+  }
+  MOLE_FLUSH();
+  MOLE_SAVE(false);
+  MOLE_FLUSH();
+
+  FILE *fp = std::fopen(kPATH, "rb");
+  if (!fp) {
+    std::printf("cannot read %s\n", kPATH);
+    return 1;
+  }
+  std::vector<std::string> lines;
+  std::string line;
+  for (int c; (c = std::fgetc(fp)) != EOF;) {
+    if (c != '\n') {
+      line += static_cast<char>(c);
+      continue;
+    }
+    lines.push_back(message(line));
+    line.clear();
+  }
+  std::fclose(fp);
+
+  int failures = 0;
+  if (lines.size() != 24) {
+    std::printf("expected 24 lines, got %zu\n", lines.size());
+    ++failures;
+  }
+  for (size_t index = 0; index + 1 < lines.size(); index += 2) {
+    if (lines[index] != lines[index + 1]) {
+      std::printf("compiled \"%s\" != runtime \"%s\"\n", lines[index].c_str(), lines[index + 1].c_str());
+      ++failures;
+    }
+  }
+  std::printf("compiled formats (%s): %d mismatches\n", MOLE_COMPILED_FORMAT ? "on" : "off", failures);
+  return failures == 0 ? 0 : 1;
+}
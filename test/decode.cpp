@@ -0,0 +1,152 @@
+/**
+  ******************************************************************************
+  * @file           : decode.cpp
+  * @author         : agent
+  * @brief          : Checks that mole-decode prints the text log BinarySink saw
+  * @date           : 2026/10/17
+  ******************************************************************************
+  */
+
+#include <Mole.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+static const char *kTEXT = "tmp.decode.log";
+static const char *kLAID_OUT = "tmp.decode.layout.log";
+static const char *kLAYOUT = "%Y/%m/%d %H:%M:%S.%e %l %v %s:%# %! %t %%";
+static const char *kBINARY = "tmp.decode.bin";
+static const char *kDECODED = "tmp.decode.txt";
+static const char *kBROKEN = "tmp.decode.broken.bin";
+
+// formatted on the producer, so BinarySink keeps its text
+struct Opaque {
+  const int *value;
+};
+template<>
+struct fmt::formatter<Opaque> : fmt::formatter<int> {
+  auto format(const Opaque &opaque, fmt::format_context &ctx) const -> decltype(ctx.out()) {
+    return fmt::formatter<int>::format(*opaque.value, ctx);
+  }
+};
+
+static bool read(const char *path, std::string &out) {
+  FILE *fp = std::fopen(path, "rb");
+  if (!fp) return false;
+  out.clear();
+  char buf[4096];
+  for (size_t size; (size = std::fread(buf, 1, sizeof(buf), fp)) != 0;) out.append(buf, size);
+  std::fclose(fp);
+  return true;
+}
+
+static bool write(const char *path, const std::string &data) {
+  FILE *fp = std::fopen(path, "wb");
+  if (!fp) return false;
+  bool ok = std::fwrite(data.data(), 1, data.size(), fp) == data.size();
+  return std::fclose(fp) == 0 && ok;
+}
+
+// exit status of mole-decode, -1 if it did not exit on its own
+static int decode(const std::string &tool, const char *in, const char *out, const char *layout = nullptr) {
+  std::string command = "\"" + tool + "\" ";
+  if (layout) command += "-l \"" + std::string(layout) + "\" ";
+  int status = std::system((command + in + " " + out).c_str());
+#ifdef _WIN32
+  return status;
+#else
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    std::printf("usage: Mole.decode <mole-decode>\n");
+    return 2;
+  }
+  std::remove(kTEXT);
+  std::remove(kLAID_OUT);
+  std::remove(kBINARY);
+  MOLE_CONSOLE(false);
+  MOLE_SAVE(true, kTEXT);
+  auto binary = std::make_shared<hzd::BinarySink>(kBINARY);
+  auto laid_out = std::make_shared<hzd::FileSink>(kLAID_OUT);
+  laid_out->SetLayout(kLAYOUT);
+  hzd::Mole::Instance().AddSink(binary);
+  hzd::Mole::Instance().AddSink(laid_out);
+  MOLE_THREAD_NAME("main");
+
+  std::string text = "text";
+  std::string format = "runtime {} {}";
+  const char *c_string = "c string";
+  int value = 7;
+  for (int round = 0; round < 100; ++round) {
+    MOLE_INFO("deferred {} {:.3f} {:>6} {:#x} {}", round, round * 0.25, text, round * 255u, 'c');
+    MOLE_WARN("c string {} {:p}", c_string, static_cast<const void *>(nullptr));
+    MOLE_ERROR("eager {}", Opaque{&value});
+    MOLE_DEBUG(format, round, text);
+    if (round % 10 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::thread([] {
+    for (int round = 0; round < 100; ++round) MOLE_FATAL("other thread {}", round);
+  }).join();
+  MOLE_FLUSH();
+  MOLE_SAVE(false);
+  hzd::Mole::Instance().RemoveSink(binary);
+  hzd::Mole::Instance().RemoveSink(laid_out);
+  MOLE_FLUSH();
+  binary.reset();
+  laid_out.reset();
+
+  int failures = 0;
+  std::string expected, actual, frames;
+  if (decode(argv[1], kBINARY, kDECODED) != 0 || !read(kTEXT, expected) || !read(kDECODED, actual)
+      || !read(kBINARY, frames)) {
+    std::printf("cannot decode %s\n", kBINARY);
+    return 1;
+  }
+  if (expected.empty() || actual != expected) {
+    std::printf("mole-decode %s differs from %s\n", kBINARY, kTEXT);
+    ++failures;
+  }
+  if (decode(argv[1], kBINARY, kDECODED, kLAYOUT) != 0 || !read(kLAID_OUT, expected) || !read(kDECODED, actual)
+      || expected.empty() || actual != expected) {
+    std::printf("mole-decode -l differs from %s\n", kLAID_OUT);
+    ++failures;
+  }
+
+  // a cut off file and a record claiming a huge payload are reported, not fatal
+  std::string broken = frames.substr(0, frames.size() - 3);
+  if (!write(kBROKEN, broken) || decode(argv[1], kBROKEN, kDECODED) != 1) {
+    std::printf("truncated input not reported\n");
+    ++failures;
+  }
+  broken = frames + "R" + std::string(1, '\0') + std::string(2, '\0') + std::string(9, '\xff') + '\x01';
+  if (!write(kBROKEN, broken) || decode(argv[1], kBROKEN, kDECODED) != 1) {
+    std::printf("oversized payload not reported\n");
+    ++failures;
+  }
+  // a record dated before the epoch, after a fresh header so its site and
+  // thread are the only ones and it has no arguments to unpack
+  broken = frames + frames.substr(0, 8) + std::string("S\0\2\1\1f\1g\1x\0", 11) + std::string("T\0\1t", 4)
+      + "R" + std::string(1, '\0') + std::string(9, '\xff') + '\x01' + std::string(2, '\0');
+  if (!write(kBROKEN, broken) || decode(argv[1], kBROKEN, kDECODED) != 1) {
+    std::printf("negative time not reported\n");
+    ++failures;
+  }
+  // a format that does not fit the packed arguments
+  broken = frames;
+  size_t spec = broken.find("{:.3f}");
+  if (spec != std::string::npos) broken.replace(spec, 6, "{:.3x}");
+  if (spec == std::string::npos || !write(kBROKEN, broken) || decode(argv[1], kBROKEN, kDECODED) != 1) {
+    std::printf("malformed format not reported\n");
+    ++failures;
+  }
+
+  std::printf("decode: %d failures\n", failures);
+  return failures == 0 ? 0 : 1;
+}
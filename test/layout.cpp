@@ -0,0 +1,92 @@
+/**
+  ******************************************************************************
+  * @file           : layout.cpp
+  * @author         : agent
+  * @brief          : Checks line layouts, Mole wide and per sink
+  * @date           : 2026/10/17
+  ******************************************************************************
+  */
+
+#include <Mole.h>
+#include <cctype>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// keeps the lines it is handed, read once the backend is flushed
+class MemorySink : public hzd::Sink {
+ public:
+  explicit MemorySink(Style style = Style::kPLAIN) : Sink(hzd::Mole::Level::kTRACE, style) {}
+  void Write(const hzd::Mole::Meta &, fmt::string_view line) override {
+    lines.emplace_back(line.data(), line.size());
+  }
+  std::vector<std::string> lines;
+};
+
+static int failures = 0;
+
+static void expect(const std::string &actual, const std::string &expected) {
+  if (actual == expected) return;
+  std::printf("expected \"%s\"\n     got \"%s\"\n", expected.c_str(), actual.c_str());
+  ++failures;
+}
+
+// digits where the layout has them, everything else as given
+static void expectShape(const std::string &actual, const std::string &shape) {
+  bool ok = actual.size() == shape.size();
+  for (size_t index = 0; ok && index < shape.size(); ++index) {
+    ok = shape[index] == '9' ? isdigit(static_cast<unsigned char>(actual[index])) != 0 : actual[index] == shape[index];
+  }
+  if (ok) return;
+  std::printf("expected shape \"%s\"\n     got \"%s\"\n", shape.c_str(), actual.c_str());
+  ++failures;
+}
+
+int main() {
+  MOLE_CONSOLE(false);
+  auto fields = std::make_shared<MemorySink>();
+  auto clock = std::make_shared<MemorySink>();
+  auto colored = std::make_shared<MemorySink>(hzd::Sink::Style::kCOLORED);
+  auto shared = std::make_shared<MemorySink>();
+  fields->SetLayout("%l|%L|%v|%s|%#|%!|%%|%q|%");
+  clock->SetLayout("%Y-%m-%dT%H:%M:%S.%e %f");
+  colored->SetLayout("[%L] %v");
+  hzd::Mole::Instance().AddSink(fields);
+  hzd::Mole::Instance().AddSink(clock);
+  hzd::Mole::Instance().AddSink(colored);
+  hzd::Mole::Instance().AddSink(shared);
+  MOLE_LAYOUT("%l %v");
+
+  int line = __LINE__ + 1;
+  MOLE_WARN("answer {}", 42);
+  MOLE_FLUSH();
+  shared->SetLayout("%v only");
+  MOLE_LAYOUT("");
+  MOLE_ERROR("second");
+  MOLE_FLUSH();
+
+  if (fields->lines.size() != 2 || clock->lines.size() != 2 || colored->lines.size() != 2
+      || shared->lines.size() != 2) {
+    std::printf("a sink missed records\n");
+    return 1;
+  }
+  expect(fields->lines[0], "WARN| WARN  |answer 42|layout.cpp|" + std::to_string(line) + "|main|%|%q|%\n");
+  expectShape(clock->lines[0], "9999-99-99T99:99:99.999 999999\n");
+  expect(colored->lines[0], "[\x1b[38;2;255;255;000m\x1b[48;2;000;000;000m WARN  \x1b[0m] answer 42\n");
+  expect(shared->lines[0], "WARN answer 42\n");
+  expect(shared->lines[1], "second only\n");
+
+  // a microsecond before the epoch is the last one of the second before it
+  hzd::Pattern pattern("%S.%f");
+  static const hzd::Mole::Site site{hzd::Mole::Level::kINFO, 1, "layout.cpp", "main", nullptr};
+  hzd::Mole::Thread thread;
+  hzd::Mole::Meta meta{&site};
+  meta.thread = &thread;
+  meta.time = hzd::Mole::time_point(std::chrono::microseconds(-1));
+  fmt::memory_buffer before;
+  pattern.Format(meta, "", &before, nullptr);
+  expect(std::string(before.data(), before.size()), "59.999999\n");
+
+  std::printf("layouts: %d failures\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -8,13 +8,20 @@
   */
 
 #include <Mole.h>
+#include <fmt/ranges.h>
 #include <iostream>
+#include <vector>
 
 int main() {
 
   MOLE_ENABLE(true);
   MOLE_CONSOLE(true);
   MOLE_SAVE(true,"tmp.log");
+  MOLE_FLUSH_ON(hzd::Mole::Level::kERROR);
+  MOLE_THREAD_NAME("main");
+  hzd::Mole::Instance().AddSink(std::make_shared<hzd::FileSink>("tmp.error.log", hzd::Mole::Level::kERROR));
+  // mole-decode tmp.bin prints the same lines as tmp.log
+  hzd::Mole::Instance().AddSink(std::make_shared<hzd::BinarySink>("tmp.bin"));
 
   std::string world = "world";
   MOLE_TRACE("hello {}",world);
@@ -23,4 +30,12 @@ int main() {
   MOLE_WARN("hello {}",world);
   MOLE_ERROR("hello {}",world);
   MOLE_FATAL("hello {}",world);
+  MOLE_INFO("{} + {:.2f} = {:>6} {}",1,2.5,"3.5",'!');
+  std::vector<int> numbers{1,2,3};
+  MOLE_INFO("joined {}",fmt::join(numbers,","));
+
+  MOLE_LEVEL(hzd::Mole::Level::kWARN);
+  MOLE_INFO("filtered {}",world);
+  MOLE_WARN("not filtered {}",world);
+  MOLE_FLUSH();
 }
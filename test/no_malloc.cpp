@@ -0,0 +1,79 @@
+/**
+  ******************************************************************************
+  * @file           : no_malloc.cpp
+  * @author         : agent
+  * @brief          : Checks that a prepared thread logs without allocating
+  * @date           : 2026/10/17
+  ******************************************************************************
+  */
+
+#include <Mole.h>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// only allocations made by the thread that armed the counter are counted,
+// the backend is free to allocate while it writes
+static thread_local bool armed = false;
+static thread_local size_t allocations = 0;
+
+void *operator new(size_t size) {
+  if (armed) ++allocations;
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (!ptr) std::abort();
+  return ptr;
+}
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+void operator delete[](void *ptr) noexcept {
+  std::free(ptr);
+}
+
+#ifdef __GLIBC__
+// fmt and the C library allocate through malloc directly
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void *malloc(size_t size) {
+  if (armed) ++allocations;
+  return __libc_malloc(size);
+}
+extern "C" void *calloc(size_t count, size_t size) {
+  if (armed) ++allocations;
+  return __libc_calloc(count, size);
+}
+extern "C" void *realloc(void *ptr, size_t size) {
+  if (armed) ++allocations;
+  return __libc_realloc(ptr, size);
+}
+#endif
+
+int main() {
+  MOLE_CONSOLE(false);
+  MOLE_SAVE(true, "tmp.no_malloc.log");
+  MOLE_PREPARE();
+
+  std::string text(100, 'x');
+  std::string format = "runtime format {} {}";
+  auto burst = [&text, &format](int round) {
+    MOLE_INFO("deferred {} {:.3f} {}", round, round * 0.5, "literal");
+    MOLE_WARN("string argument {}", text);
+    MOLE_ERROR(format, round, text);
+  };
+
+  // two laps around the ring so every slot has been used and handed back
+  for (int round = 0; round < 2 * META_RING_SIZE; ++round) burst(round);
+  MOLE_FLUSH();
+
+  armed = true;
+  for (int round = 0; round < 100000; ++round) burst(round);
+  armed = false;
+  MOLE_FLUSH();
+
+  printf("allocations while logging: %zu\n", allocations);
+  return allocations == 0 ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+/**
+  ******************************************************************************
+  * @file           : overflow.cpp
+  * @author         : agent
+  * @brief          : Checks that every record under each OnFull policy is
+  *                   either written or counted as dropped
+  * @date           : 2026/10/17
+  ******************************************************************************
+  */
+
+#include <Mole.h>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static constexpr int kPRODUCERS = 4;
+static constexpr int kRECORDS = 3 * META_RING_SIZE;
+static constexpr std::chrono::milliseconds kSTALL{400};
+
+// counts the records it is handed, stalls the backend for kSTALL on the
+// first one and for 20 ms on every 1024th after it, long enough for the
+// producers to fill their rings many times over
+class StallingSink : public hzd::Sink {
+ public:
+  StallingSink() : Sink(hzd::Mole::Level::kTRACE, Style::kRAW) {}
+  void Write(const hzd::Mole::Meta &meta, fmt::string_view) override {
+    // the backend's own "messages dropped" reports are WARN
+    if (meta.site->level != hzd::Mole::Level::kINFO) return;
+    uint64_t count = written.fetch_add(1, std::memory_order_relaxed);
+    if (count == 0) {
+      std::this_thread::sleep_for(kSTALL);
+    } else if (count % 1024 == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+  }
+  std::atomic<uint64_t> written{0};
+};
+
+static int run(const std::shared_ptr<StallingSink> &sink, hzd::Mole::Overflow policy, const char *name) {
+  MOLE_ON_FULL(policy);
+  uint64_t dropped = hzd::Mole::Instance().Dropped(hzd::Mole::Level::kINFO);
+  sink->written = 0;
+
+  std::vector<std::thread> producers;
+  std::atomic<int64_t> slowest_ms{0};
+  for (int producer = 0; producer < kPRODUCERS; ++producer) {
+    producers.emplace_back([producer, &slowest_ms] {
+      auto start = std::chrono::steady_clock::now();
+      for (int round = 0; round < kRECORDS; ++round) MOLE_INFO("producer {} round {}", producer, round);
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+      int64_t slowest = slowest_ms.load();
+      while (ms.count() > slowest && !slowest_ms.compare_exchange_weak(slowest, ms.count())) {}
+    });
+  }
+  for (auto &producer : producers) producer.join();
+  MOLE_FLUSH();
+
+  uint64_t logged = static_cast<uint64_t>(kPRODUCERS) * kRECORDS;
+  uint64_t written = sink->written.load();
+  dropped = hzd::Mole::Instance().Dropped(hzd::Mole::Level::kINFO) - dropped;
+  std::printf("%-9s logged %llu written %llu dropped %llu slowest producer %lld ms\n", name,
+              static_cast<unsigned long long>(logged), static_cast<unsigned long long>(written),
+              static_cast<unsigned long long>(dropped), static_cast<long long>(slowest_ms.load()));
+  if (written + dropped != logged) {
+    std::printf("%s: written + dropped != logged\n", name);
+    return 1;
+  }
+  if ((policy == hzd::Mole::Overflow::kBLOCK) != (dropped == 0)) {
+    std::printf("%s: %s\n", name, dropped == 0 ? "nothing was dropped" : "dropped while blocking");
+    return 1;
+  }
+  // kDROP and kOVERWRITE lose records rather than wait for the stalled sink
+  if (policy != hzd::Mole::Overflow::kBLOCK && slowest_ms.load() >= kSTALL.count() / 2) {
+    std::printf("%s: a producer waited for the stalled sink\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+int main() {
+  MOLE_CONSOLE(false);
+  auto sink = std::make_shared<StallingSink>();
+  hzd::Mole::Instance().AddSink(sink);
+  MOLE_FLUSH();
+
+  int failures = 0;
+  failures += run(sink, hzd::Mole::Overflow::kBLOCK, "block");
+  failures += run(sink, hzd::Mole::Overflow::kDROP, "drop");
+  failures += run(sink, hzd::Mole::Overflow::kOVERWRITE, "overwrite");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+/**
+  ******************************************************************************
+  * @file           : spill.cpp
+  * @author         : agent
+  * @brief          : Checks short records landing in a slot that held a huge one
+  * @date           : 2026/10/17
+  ******************************************************************************
+  */
+
+#include <Mole.h>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+// keeps the messages it is handed, read once the backend is flushed
+class MemorySink : public hzd::Sink {
+ public:
+  MemorySink() : Sink(hzd::Mole::Level::kTRACE) {}
+  void Write(const hzd::Mole::Meta &, fmt::string_view line) override {
+    lines.emplace_back(line.data(), line.size());
+  }
+  std::vector<std::string> lines;
+};
+
+int main() {
+  MOLE_CONSOLE(false);
+  MOLE_LAYOUT("%v");
+  auto sink = std::make_shared<MemorySink>();
+  hzd::Mole::Instance().AddSink(sink);
+  MOLE_FLUSH();
+
+  // a fresh thread starts its ring at slot 0, so the records at positions
+  // 0 and 1 share their slots with those at META_RING_SIZE and the one after
+  std::thread([] {
+    std::string name = "short";
+    std::string huge(100 * 1024, 'x');
+    MOLE_INFO(fmt::runtime("{}"), huge);
+    MOLE_INFO("{}", huge);
+    for (int round = 2; round < META_RING_SIZE; ++round) MOLE_INFO("filler {}", round);
+    MOLE_INFO(fmt::runtime("eager {}"), name);
+    MOLE_INFO("deferred {}", name);
+  }).join();
+  MOLE_FLUSH();
+
+  size_t count = sink->lines.size();
+  bool ok = count == META_RING_SIZE + 2 && sink->lines[count - 2] == "eager short\n"
+      && sink->lines[count - 1] == "deferred short\n";
+  if (!ok) {
+    std::printf("expected \"eager short\" and \"deferred short\" last, got %zu lines\n", count);
+    for (size_t index = count < 2 ? 0 : count - 2; index < count; ++index) {
+      std::printf("  \"%.40s\"\n", sink->lines[index].c_str());
+    }
+    return 1;
+  }
+  std::printf("spill: ok\n");
+  return 0;
+}
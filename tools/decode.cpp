@@ -0,0 +1,278 @@
+/**
+  ******************************************************************************
+  * @file           : decode.cpp
+  * @author         : agent
+  * @brief          : mole-decode, renders a BinarySink file as Mole's text log
+  * @date           : 2026/10/17
+  ******************************************************************************
+  */
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "Mole.h"
+#include "Binary.h"
+#include "fmt/args.h"
+
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <string>
+
+namespace {
+
+using hzd::Mole;
+using Args = fmt::dynamic_format_arg_store<fmt::format_context>;
+
+class Reader {
+ public:
+  explicit Reader(FILE *fp) : fp_(fp) {
+    if (fseek(fp_, 0, SEEK_END) == 0) {
+      long size = ftell(fp_);
+      if (size >= 0) size_ = static_cast<uint64_t>(size);
+    }
+    rewind(fp_);
+  }
+
+  bool Byte(uint8_t &value) {
+    int c = fgetc(fp_);
+    if (c == EOF) return false;
+    value = static_cast<uint8_t>(c);
+    ++offset_;
+    return true;
+  }
+
+  bool Varint(uint64_t &value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      uint8_t byte;
+      if (!Byte(byte)) return false;
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) return true;
+    }
+    return false;
+  }
+
+  // a size past the end of the file is corrupt, it is not allocated
+  bool Bytes(std::string &out, uint64_t size) {
+    if (size > size_ - offset_) return false;
+    out.resize(size);
+    offset_ += size;
+    return size == 0 || fread(&out[0], 1, size, fp_) == size;
+  }
+
+  bool String(std::string &out) {
+    uint64_t size;
+    return Varint(size) && Bytes(out, size);
+  }
+
+ private:
+  FILE *fp_;
+  // bytes in the file, unknown for pipes, and read so far
+  uint64_t size_{UINT64_MAX};
+  uint64_t offset_{0};
+};
+
+// a dictionary entry, site points into the strings, so entries never move
+struct Site {
+  std::string file, function, format, signature;
+  Mole::Site site;
+};
+
+template<class T>
+bool push(Args &args, const char *&cursor, const char *end) {
+  if (static_cast<size_t>(end - cursor) < sizeof(T)) return false;
+  T value;
+  memcpy(&value, cursor, sizeof(T));
+  cursor += sizeof(T);
+  args.push_back(value);
+  return true;
+}
+
+// the payload is decoded to the types it was packed from, so every format
+// spec behaves as it did in the program
+bool unpack(Args &args, const std::string &signature, const std::string &payload) {
+  const char *cursor = payload.data(), *end = payload.data() + payload.size();
+  for (char kind : signature) {
+    bool ok = false;
+    switch (kind) {
+      case 'b': ok = push<bool>(args, cursor, end); break;
+      case 'c': ok = push<char>(args, cursor, end); break;
+      case 'a': ok = push<int8_t>(args, cursor, end); break;
+      case 'h': ok = push<int16_t>(args, cursor, end); break;
+      case 'i': ok = push<int32_t>(args, cursor, end); break;
+      case 'l': ok = push<int64_t>(args, cursor, end); break;
+      case 'A': ok = push<uint8_t>(args, cursor, end); break;
+      case 'H': ok = push<uint16_t>(args, cursor, end); break;
+      case 'I': ok = push<uint32_t>(args, cursor, end); break;
+      case 'L': ok = push<uint64_t>(args, cursor, end); break;
+      case 'f': ok = push<float>(args, cursor, end); break;
+      case 'd': ok = push<double>(args, cursor, end); break;
+      case 'p': ok = push<const void *>(args, cursor, end); break;
+      case 's': {
+        size_t size;
+        if (static_cast<size_t>(end - cursor) < sizeof(size)) break;
+        memcpy(&size, cursor, sizeof(size));
+        cursor += sizeof(size);
+        if (static_cast<size_t>(end - cursor) < size) break;
+        args.push_back(fmt::string_view{cursor, size});
+        cursor += size;
+        ok = true;
+        break;
+      }
+      case 'z': {
+        hzd::detail::CString value;
+        size_t size;
+        if (static_cast<size_t>(end - cursor) < sizeof(value.address) + sizeof(size)) break;
+        memcpy(&value.address, cursor, sizeof(value.address));
+        memcpy(&size, cursor + sizeof(value.address), sizeof(size));
+        cursor += sizeof(value.address) + sizeof(size);
+        if (static_cast<size_t>(end - cursor) < size) break;
+        value.text = {cursor, size};
+        args.push_back(value);
+        cursor += size;
+        ok = true;
+        break;
+      }
+      default: break;
+    }
+    if (!ok) return false;
+  }
+  return true;
+}
+
+int decode(FILE *in, FILE *out, hzd::Pattern &pattern) {
+  // latest time a record may carry, later ones do not fit a time_point
+  static const int64_t kMAX_US =
+      std::chrono::duration_cast<std::chrono::microseconds>(Mole::time_point::duration::max()).count();
+  Reader reader(in);
+  std::deque<Site> sites;
+  std::deque<Mole::Thread> threads;
+  int64_t time_us = 0;
+  bool started = false;
+  std::string payload;
+  fmt::memory_buffer line, text;
+  Mole::Meta meta;
+
+  uint8_t tag;
+  while (reader.Byte(tag)) {
+    bool ok = true;
+    switch (tag) {
+      case hzd::binary::kMAGIC[0]: {
+        std::string magic, layout;
+        ok = reader.Bytes(magic, sizeof(hzd::binary::kMAGIC) - 1) && reader.Bytes(layout, 4)
+            && magic.compare(0, magic.size(), hzd::binary::kMAGIC + 1, magic.size()) == 0;
+        if (!ok) break;
+        if (layout[0] == 0 || static_cast<uint8_t>(layout[0]) > hzd::binary::kVERSION) {
+          fmt::print(stderr, "mole-decode: unsupported version {}\n", static_cast<int>(layout[0]));
+          return 1;
+        }
+        if (layout[1] != (hzd::binary::LittleEndian() ? 1 : 0)
+            || layout[2] != static_cast<char>(sizeof(size_t))
+            || layout[3] != static_cast<char>(sizeof(void *))) {
+          fmt::print(stderr, "mole-decode: written on a platform with another byte order or word size\n");
+          return 1;
+        }
+        sites.clear();
+        threads.clear();
+        time_us = 0;
+        started = true;
+        break;
+      }
+      case hzd::binary::kSITE: {
+        uint64_t id, line_number;
+        uint8_t level;
+        Site site;
+        ok = started && reader.Varint(id) && id == sites.size() && reader.Byte(level)
+            && level <= static_cast<uint8_t>(Mole::Level::kSILENCE) && reader.Varint(line_number)
+            && reader.String(site.file) && reader.String(site.function)
+            && reader.String(site.format) && reader.String(site.signature);
+        if (!ok) break;
+        sites.push_back(std::move(site));
+        Site &entry = sites.back();
+        entry.site = {static_cast<Mole::Level>(level), static_cast<uint32_t>(line_number), entry.file.c_str(),
+                      entry.function.c_str(), entry.format.c_str()};
+        break;
+      }
+      case hzd::binary::kTHREAD: {
+        uint64_t id;
+        Mole::Thread thread;
+        ok = started && reader.Varint(id) && id == threads.size() && reader.String(thread.label);
+        if (ok) threads.push_back(std::move(thread));
+        break;
+      }
+      case hzd::binary::kRECORD: {
+        uint64_t site_id, delta, thread_id, size;
+        ok = started && reader.Varint(site_id) && site_id < sites.size()
+            && reader.Varint(delta) && reader.Varint(thread_id) && thread_id < threads.size()
+            && reader.Varint(size) && reader.Bytes(payload, size);
+        if (!ok) break;
+        const Site &site = sites[site_id];
+        // records start at the epoch, a time before it or past kMAX_US is corrupt
+        int64_t step = hzd::binary::UnZigZag(delta);
+        ok = step < 0 ? step >= -time_us : step <= kMAX_US - time_us;
+        if (!ok) break;
+        time_us += step;
+        Args args;
+        if (!unpack(args, site.signature, payload)) {
+          fmt::print(stderr, "mole-decode: malformed record at {}:{}\n", site.file, site.site.line);
+          return 1;
+        }
+        text.clear();
+        try {
+          fmt::vformat_to(fmt::appender(text), site.format, args);
+        } catch (const fmt::format_error &error) {
+          fmt::print(stderr, "mole-decode: corrupt format at {}:{}: {}\n", site.file, site.site.line, error.what());
+          return 1;
+        }
+        meta.site = &site.site;
+        meta.thread = &threads[thread_id];
+        meta.time = Mole::time_point(
+            std::chrono::duration_cast<Mole::time_point::duration>(std::chrono::microseconds(time_us)));
+        line.clear();
+        pattern.Format(meta, {text.data(), text.size()}, &line, nullptr);
+        fwrite(line.data(), 1, line.size(), out);
+        break;
+      }
+      default: ok = false;
+    }
+    if (!ok) {
+      fmt::print(stderr, "mole-decode: corrupt or truncated input\n");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  // -l takes the layout the program set through Mole::Layout or Sink::SetLayout
+  const char *layout = LINE_LAYOUT;
+  int first = 1;
+  if (argc > 2 && strcmp(argv[1], "-l") == 0) {
+    layout = argv[2];
+    first = 3;
+  }
+  if (argc - first < 1 || argc - first > 2) {
+    fmt::print(stderr, "usage: mole-decode [-l layout] <binary log> [text log]\n");
+    return 2;
+  }
+  FILE *in = fopen(argv[first], "rb");
+  if (!in) {
+    fmt::print(stderr, "mole-decode: cannot open {}\n", argv[first]);
+    return 1;
+  }
+  FILE *out = argc - first == 2 ? fopen(argv[first + 1], "wb") : stdout;
+  if (!out) {
+    fmt::print(stderr, "mole-decode: cannot open {}\n", argv[first + 1]);
+    fclose(in);
+    return 1;
+  }
+  hzd::Pattern pattern(*layout ? layout : LINE_LAYOUT);
+  int status = decode(in, out, pattern);
+  fclose(in);
+  if (out != stdout) fclose(out);
+  return status;
+}